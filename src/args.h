@@ -12,9 +12,25 @@ struct Args {
     int rotation_angle = 0;
     int sample_rate = 44100;
     int peer_timeout = 10;
+    int capture_buffer_count = 6;
+    int event_loop_core = -1;
+    int record_fragment_ms = 0;
+    int record_pre_event_sec = 5;
+    int record_post_event_sec = 30;
+    int record_max_age_hours = 0;
+    int record_max_mb = 0;
+    int record_min_free_mb = 400;
+    int record_thin_after_hours = 0;
+    int record_thin_keep_one_of = 4;
+    int motion_fps = 5;
+    int motion_sensitivity = 50;
     bool no_audio = false;
     bool hw_accel = false;
     bool use_libcamera = false;
+    bool shared_encoder = false;
+    bool record_on_trigger = false;
+    bool record_thin_keyframes = false;
+    bool motion_detection = false;
     uint32_t format = V4L2_PIX_FMT_MJPEG;
     std::string v4l2_format = "mjpeg";
     std::string device = "/dev/video0";
@@ -24,6 +40,7 @@ struct Args {
     std::string turn_username = "";
     std::string turn_password = "";
     std::string record_path = "";
+    std::string motion_zones = "";
 
     // mqtt signaling
     int mqtt_port = 1883;
@@ -1,9 +1,11 @@
 #include "v4l2_capturer.h"
 
+#include <algorithm>
+
 // Linux
 #include <linux/videodev2.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
-#include <sys/select.h>
 
 // WebRTC
 #include <modules/video_capture/video_capture_factory.h>
@@ -11,6 +13,13 @@
 
 #include "common/logging.h"
 
+// keep enough buffers in the driver queue so the camera never stalls on the consumers.
+static const int kMinQueuedBuffers = 2;
+static const int kJpegFrameTimeoutMs = 1000;
+// the frames waiting for the delivery thread, the newer ones are dropped beyond it.
+static const size_t kMaxPendingBuffers = 2;
+static const int kDeliveryWaitMs = 100;
+
 std::shared_ptr<V4l2Capturer> V4l2Capturer::Create(Args args) {
     auto ptr = std::make_shared<V4l2Capturer>(args);
     ptr->Init(args.device);
@@ -22,11 +31,15 @@ std::shared_ptr<V4l2Capturer> V4l2Capturer::Create(Args args) {
 }
 
 V4l2Capturer::V4l2Capturer(Args args)
-    : buffer_count_(4),
+    : buffer_count_(std::max(args.capture_buffer_count, kMinQueuedBuffers + 1)),
       hw_accel_(args.hw_accel),
       format_(args.format),
       has_first_keyframe_(false),
-      config_(args) {}
+      config_(args),
+      event_loop_(EventLoop::Shared()),
+      lease_state_(std::make_shared<LeaseState>()),
+      is_jpeg_requested_(false),
+      jpeg_sequence_(0) {}
 
 void V4l2Capturer::Init(std::string device) {
     fd_ = V4l2Util::OpenDevice(device.c_str());
@@ -37,11 +50,21 @@ void V4l2Capturer::Init(std::string device) {
 }
 
 V4l2Capturer::~V4l2Capturer() {
-    worker_.reset();
+    event_loop_->Remove(fd_);
+    delivery_worker_.reset();
+    {
+        std::lock_guard<std::mutex> lock(delivery_mtx_);
+        pending_buffers_.clear();
+    }
     decoder_.reset();
+    // the leases held by the capturer itself, the rest are returned by the consumers.
+    frame_buffer_ = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(jpeg_mtx_);
+        jpeg_frame_ = nullptr;
+    }
     V4l2Util::StreamOff(fd_, capture_.type);
-    V4l2Util::DeallocateBuffer(fd_, &capture_);
-    V4l2Util::CloseDevice(fd_);
+    ReleaseWhenReturned();
 }
 
 int V4l2Capturer::fps() const { return fps_; }
@@ -121,21 +144,6 @@ V4l2Capturer &V4l2Capturer::SetRotation(int angle) {
 }
 
 void V4l2Capturer::CaptureImage() {
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(fd_, &fds);
-    timeval tv = {};
-    tv.tv_sec = 0;
-    tv.tv_usec = 500000;
-    int r = select(fd_ + 1, &fds, NULL, NULL, &tv);
-    if (r == -1) {
-        ERROR_PRINT("select failed");
-        return;
-    } else if (r == 0) { // timeout
-        DEBUG_PRINT("capture timeout");
-        return;
-    }
-
     v4l2_buffer buf = {};
     buf.type = capture_.type;
     buf.memory = capture_.memory;
@@ -144,19 +152,131 @@ void V4l2Capturer::CaptureImage() {
         return;
     }
 
+    // the buffer is queued back once the last holder of the lease releases it.
+    bool is_lendable = false;
+    auto lease = LeaseBuffer(buf, is_lendable);
+
     V4l2Buffer buffer((uint8_t *)capture_.buffers[buf.index].start, buf.bytesused, buf.flags,
                       buf.timestamp);
-    NextBuffer(buffer);
+    if (is_lendable) {
+        buffer.lease = lease;
+    }
+
+    // the consumers decode, scale and start the recording, which must not hold up the loop.
+    {
+        std::lock_guard<std::mutex> lock(delivery_mtx_);
+        if (pending_buffers_.size() >= kMaxPendingBuffers) {
+            // the lease is dropped, so it goes straight back to the camera.
+            return;
+        }
+        pending_buffers_.push_back({buffer, lease});
+    }
+    delivery_cond_.notify_one();
+}
+
+void V4l2Capturer::DeliverBuffer() {
+    PendingBuffer pending;
+    {
+        std::unique_lock<std::mutex> lock(delivery_mtx_);
+        if (!delivery_cond_.wait_for(lock, std::chrono::milliseconds(kDeliveryWaitMs),
+                                     [this] { return !pending_buffers_.empty(); })) {
+            return;
+        }
+        pending = std::move(pending_buffers_.front());
+        pending_buffers_.pop_front();
+    }
+    // the buffer stays out of the driver queue until it's delivered, lent or not.
+    NextBuffer(pending.buffer);
+}
 
-    if (!V4l2Util::QueueBuffer(fd_, &buf)) {
+std::shared_ptr<void> V4l2Capturer::LeaseBuffer(const v4l2_buffer &buf, bool &is_lendable) {
+    auto state = lease_state_;
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        state->num_queued--;
+        state->num_leased++;
+        is_lendable = state->num_queued >= kMinQueuedBuffers;
+    }
+
+    auto *inner = new v4l2_buffer(buf);
+    return std::shared_ptr<void>(inner, [state](void *ptr) {
+        auto *inner = static_cast<v4l2_buffer *>(ptr);
+        {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            if (state->is_streaming && V4l2Util::QueueBuffer(state->fd, inner)) {
+                state->num_queued++;
+            }
+            if (--state->num_leased == 0 && state->is_closing) {
+                ReleaseBuffers(*state);
+            }
+        }
+        delete inner;
+    });
+}
+
+void V4l2Capturer::ReleaseWhenReturned() {
+    std::lock_guard<std::mutex> lock(lease_state_->mtx);
+    lease_state_->is_streaming = false;
+    lease_state_->is_closing = true;
+    lease_state_->fd = fd_;
+    lease_state_->capture = capture_;
+    if (lease_state_->num_leased > 0) {
+        // the data is still read through the mappings, the last lease releases them.
+        DEBUG_PRINT("%d capture buffers are still leased, release the camera after them.",
+                    lease_state_->num_leased);
         return;
     }
+    ReleaseBuffers(*lease_state_);
+}
+
+void V4l2Capturer::ReleaseBuffers(LeaseState &state) {
+    V4l2Util::DeallocateBuffer(state.fd, &state.capture);
+    V4l2Util::CloseDevice(state.fd);
+    state.fd = -1;
 }
 
 rtc::scoped_refptr<webrtc::I420BufferInterface> V4l2Capturer::GetI420Frame() {
+    if (!frame_buffer_) {
+        return nullptr;
+    }
     return frame_buffer_->ToI420();
 }
 
+rtc::scoped_refptr<V4l2FrameBuffer> V4l2Capturer::GetJpegFrame() {
+    if (format_ != V4L2_PIX_FMT_MJPEG) {
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(jpeg_mtx_);
+    auto sequence = jpeg_sequence_;
+    is_jpeg_requested_.store(true);
+    if (!jpeg_cond_.wait_for(lock, std::chrono::milliseconds(kJpegFrameTimeoutMs),
+                             [&]() { return jpeg_sequence_ != sequence; })) {
+        ERROR_PRINT("No jpeg frame is captured in %d ms.", kJpegFrameTimeoutMs);
+        return nullptr;
+    }
+    return jpeg_frame_;
+}
+
+void V4l2Capturer::TakeJpegFrame(V4l2Buffer &buffer) {
+    auto jpeg_frame = V4l2FrameBuffer::Create(width_, height_, buffer, format_);
+    // the capture buffer goes back to the camera, the snapshot may take a while to send.
+    jpeg_frame->CopyBufferData();
+    {
+        std::lock_guard<std::mutex> lock(jpeg_mtx_);
+        jpeg_frame_ = jpeg_frame;
+        jpeg_sequence_++;
+        is_jpeg_requested_.store(false);
+    }
+    jpeg_cond_.notify_all();
+}
+
+void V4l2Capturer::RequestKeyFrame() {
+    if (format_ == V4L2_PIX_FMT_H264) {
+        V4l2Util::SetExtCtrl(fd_, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1);
+    }
+}
+
 void V4l2Capturer::NextBuffer(V4l2Buffer &buffer) {
     if (hw_accel_) {
         // hardware encoding
@@ -165,27 +285,24 @@ void V4l2Capturer::NextBuffer(V4l2Buffer &buffer) {
         }
 
         if (IsCompressedFormat()) {
-            decoder_->EmplaceBuffer(buffer, [this](V4l2Buffer decoded_buffer) {
-                frame_buffer_ =
-                    V4l2FrameBuffer::Create(width_, height_, decoded_buffer, V4L2_PIX_FMT_YUV420);
-                NextFrameBuffer(frame_buffer_);
-            });
+            decoder_->EmplaceBuffer(buffer);
         } else {
             frame_buffer_ = V4l2FrameBuffer::Create(width_, height_, buffer, format_);
             NextFrameBuffer(frame_buffer_);
         }
     } else {
         // software decoding
+        // the h264 packets are passed through to the track and recorder without decoding.
         if (format_ != V4L2_PIX_FMT_H264) {
             frame_buffer_ = V4l2FrameBuffer::Create(width_, height_, buffer, format_);
             NextFrameBuffer(frame_buffer_);
-        } else {
-            // todo: h264 decoding
-            INFO_PRINT("Software decoding h264 camera source is not support now.");
-            exit(1);
         }
     }
 
+    if (format_ == V4L2_PIX_FMT_MJPEG && is_jpeg_requested_.load()) {
+        TakeJpegFrame(buffer);
+    }
+
     NextRawBuffer(buffer);
 }
 
@@ -195,16 +312,34 @@ void V4l2Capturer::StartCapture() {
         exit(0);
     }
 
+    {
+        std::lock_guard<std::mutex> lock(lease_state_->mtx);
+        lease_state_->fd = fd_;
+        lease_state_->num_queued = capture_.num_buffers;
+        lease_state_->is_streaming = true;
+    }
+
     V4l2Util::StreamOn(fd_, capture_.type);
 
     if (hw_accel_ && IsCompressedFormat()) {
         decoder_ = std::make_unique<V4l2Decoder>();
         decoder_->Configure(config_.width, config_.height, format_, true);
+        decoder_->OnCapture([this](V4l2Buffer &decoded_buffer, uint64_t) {
+            frame_buffer_ =
+                V4l2FrameBuffer::Create(width_, height_, decoded_buffer, V4L2_PIX_FMT_YUV420);
+            NextFrameBuffer(frame_buffer_);
+        });
         decoder_->Start();
     }
 
-    worker_.reset(new Worker("V4l2Capture", [this]() {
-        CaptureImage();
+    delivery_worker_.reset(new Worker("Capture Delivery", [this]() {
+        DeliverBuffer();
     }));
-    worker_->Run();
+    delivery_worker_->Run();
+
+    event_loop_->Add(fd_, EPOLLIN, [this](uint32_t events) {
+        if (events & EPOLLIN) {
+            CaptureImage();
+        }
+    });
 }
@@ -1,10 +1,16 @@
 #ifndef V4L2_CAPTURER_H_
 #define V4L2_CAPTURER_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 #include <modules/video_capture/video_capture.h>
 
 #include "args.h"
 #include "capturer/video_capturer.h"
+#include "common/event_loop.h"
 #include "common/interface/subject.h"
 #include "common/v4l2_frame_buffer.h"
 #include "common/v4l2_utils.h"
@@ -25,8 +31,22 @@ class V4l2Capturer : public VideoCapturer {
     Args config() const override;
     void StartCapture() override;
     rtc::scoped_refptr<webrtc::I420BufferInterface> GetI420Frame() override;
+    rtc::scoped_refptr<V4l2FrameBuffer> GetJpegFrame() override;
+    void RequestKeyFrame() override;
 
   private:
+    // tracks the capture buffers which are lent out to the consumers. Once the capturer is
+    // closing, it owns the buffers and the device until the last lease is returned.
+    struct LeaseState {
+        std::mutex mtx;
+        int fd = -1;
+        int num_queued = 0;
+        int num_leased = 0;
+        bool is_streaming = false;
+        bool is_closing = false;
+        V4l2BufferGroup capture;
+    };
+
     int fd_;
     int fps_;
     int width_;
@@ -37,16 +57,41 @@ class V4l2Capturer : public VideoCapturer {
     uint32_t format_;
     Args config_;
     V4l2BufferGroup capture_;
-    std::unique_ptr<Worker> worker_;
+    std::shared_ptr<EventLoop> event_loop_;
     std::unique_ptr<V4l2Decoder> decoder_;
+    std::shared_ptr<LeaseState> lease_state_;
 
     rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer_;
     void NextBuffer(V4l2Buffer &raw_buffer);
 
+    // the dequeued buffers are handed to the consumers on their own thread.
+    struct PendingBuffer {
+        V4l2Buffer buffer;
+        std::shared_ptr<void> lease;
+    };
+    std::mutex delivery_mtx_;
+    std::condition_variable delivery_cond_;
+    std::deque<PendingBuffer> pending_buffers_;
+    std::unique_ptr<Worker> delivery_worker_;
+    void DeliverBuffer();
+
+    // a jpeg is copied out of the capture buffer only when a snapshot asks for it.
+    std::mutex jpeg_mtx_;
+    std::condition_variable jpeg_cond_;
+    std::atomic<bool> is_jpeg_requested_;
+    uint64_t jpeg_sequence_;
+    rtc::scoped_refptr<V4l2FrameBuffer> jpeg_frame_;
+    void TakeJpegFrame(V4l2Buffer &buffer);
+
     V4l2Capturer &SetFormat(int width, int height);
     V4l2Capturer &SetFps(int fps = 30);
     V4l2Capturer &SetRotation(int angle);
 
+    std::shared_ptr<void> LeaseBuffer(const v4l2_buffer &buf, bool &is_lendable);
+    // unmaps the buffers and closes the device now, or when the last lease is returned.
+    void ReleaseWhenReturned();
+    static void ReleaseBuffers(LeaseState &state);
+
     void Init(std::string device);
     bool IsCompressedFormat() const;
     void CaptureImage();
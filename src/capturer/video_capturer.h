@@ -24,6 +24,10 @@ class VideoCapturer {
     virtual Args config() const = 0;
     virtual void StartCapture() = 0;
     virtual rtc::scoped_refptr<webrtc::I420BufferInterface> GetI420Frame() = 0;
+    // the next frame as the camera compressed it, only the mjpeg sources are able to provide.
+    virtual rtc::scoped_refptr<V4l2FrameBuffer> GetJpegFrame() { return nullptr; }
+    // Only the sources which output the compressed stream are able to honor it.
+    virtual void RequestKeyFrame() {}
 
     std::shared_ptr<Observable<V4l2Buffer>> AsRawBufferObservable() {
         return raw_buffer_subject_.AsObservable();
@@ -100,6 +100,8 @@ void H264Encoder::Encode(rtc::scoped_refptr<webrtc::I420BufferInterface> frame_b
     }
 }
 
+void H264Encoder::ForceKeyFrame() { encoder_->ForceIntraFrame(true); }
+
 void H264Encoder::ReleaseCodec() {
     encoder_->Uninitialize();
     WelsDestroySVCEncoder(encoder_);
@@ -17,6 +17,8 @@ class H264Encoder {
     void Init();
     void Encode(rtc::scoped_refptr<webrtc::I420BufferInterface> frame_buffer,
                 std::function<void(uint8_t *, int)> on_capture);
+    // the next frame is encoded as an IDR.
+    void ForceKeyFrame();
     void ReleaseCodec();
 
   private:
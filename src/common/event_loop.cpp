@@ -0,0 +1,185 @@
+#include "common/event_loop.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common/logging.h"
+
+static const int kMaxEvents = 16;
+
+std::shared_ptr<EventLoop> EventLoop::Create(std::string name) {
+    return std::make_shared<EventLoop>(name);
+}
+
+std::shared_ptr<EventLoop> EventLoop::Shared() {
+    static std::shared_ptr<EventLoop> loop = Create("V4l2EventLoop");
+    return loop;
+}
+
+EventLoop::EventLoop(std::string name)
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      dispatching_fd_(-1),
+      abort_(false),
+      cpu_core_(-1),
+      is_affinity_changed_(false) {
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        ERROR_PRINT("Failed to create the event loop: %s", strerror(errno));
+        exit(-1);
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    worker_.reset(new Worker(name, [this]() {
+        Poll();
+    }));
+    worker_->Run();
+}
+
+EventLoop::~EventLoop() {
+    abort_.store(true);
+    Wake();
+    worker_.reset();
+    close(wake_fd_);
+    close(epoll_fd_);
+}
+
+bool EventLoop::Add(int fd, uint32_t events, EventHandler handler, ErrorHandler on_error) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ERROR_PRINT("fd(%d) failed to join the event loop: %s", fd, strerror(errno));
+        return false;
+    }
+    handlers_[fd] = std::make_shared<Handlers>(Handlers{std::move(handler), std::move(on_error)});
+    return true;
+}
+
+bool EventLoop::Modify(int fd, uint32_t events) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        ERROR_PRINT("fd(%d) failed to modify the events: %s", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::Remove(int fd) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    // it may be gone already by an error, whose handler could still be running.
+    if (handlers_.erase(fd) > 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    if (!IsLoopThread()) {
+        cond_.wait(lock, [this, fd] {
+            return dispatching_fd_ != fd;
+        });
+    }
+}
+
+void EventLoop::SetAffinity(int cpu_core) {
+    cpu_core_.store(cpu_core);
+    is_affinity_changed_.store(true);
+    Wake();
+}
+
+bool EventLoop::IsLoopThread() const {
+    return loop_thread_id_.load() == std::this_thread::get_id();
+}
+
+void EventLoop::Wake() {
+    uint64_t value = 1;
+    if (write(wake_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        ERROR_PRINT("Failed to wake up the event loop: %s", strerror(errno));
+    }
+}
+
+void EventLoop::ApplyAffinity() {
+    int cpu_core = cpu_core_.load();
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu_core, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
+        ERROR_PRINT("Failed to pin the event loop on core %d", cpu_core);
+        return;
+    }
+    DEBUG_PRINT("The event loop is pinned on core %d", cpu_core);
+}
+
+void EventLoop::Poll() {
+    if (abort_.load()) {
+        return;
+    }
+
+    loop_thread_id_.store(std::this_thread::get_id());
+    if (is_affinity_changed_.exchange(false)) {
+        ApplyAffinity();
+    }
+
+    epoll_event events[kMaxEvents];
+    int n = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (n < 0) {
+        if (errno != EINTR) {
+            ERROR_PRINT("epoll_wait: %s", strerror(errno));
+        }
+        return;
+    }
+
+    for (int i = 0; i < n && !abort_.load(); i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd_) {
+            uint64_t value;
+            while (read(wake_fd_, &value, sizeof(value)) > 0) {
+            }
+            continue;
+        }
+
+        Dispatch(fd, events[i].events);
+    }
+}
+
+void EventLoop::Dispatch(int fd, uint32_t events) {
+    std::shared_ptr<Handlers> handlers;
+    bool is_failed = events & (EPOLLERR | EPOLLHUP);
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = handlers_.find(fd);
+        if (it == handlers_.end()) {
+            return;
+        }
+        handlers = it->second;
+        if (is_failed) {
+            // level-triggered, it would be reported on every wait until it's removed.
+            handlers_.erase(it);
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        dispatching_fd_ = fd;
+    }
+
+    if (!is_failed) {
+        handlers->on_event(events);
+    } else {
+        ERROR_PRINT("fd(%d) is removed from the event loop on events 0x%x.", fd, events);
+        if (handlers->on_error) {
+            handlers->on_error(events);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        dispatching_fd_ = -1;
+    }
+    cond_.notify_all();
+}
@@ -0,0 +1,62 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "common/worker.h"
+
+/* Multiplexes the v4l2 fds on a single epoll thread instead of a select() thread per fd.
+ * The handlers run on the loop thread, so they must never block on another fd of the loop. */
+class EventLoop {
+  public:
+    using EventHandler = std::function<void(uint32_t events)>;
+    // called once on the loop thread when the fd reports EPOLLERR or EPOLLHUP, by then the fd
+    // is already out of the loop.
+    using ErrorHandler = std::function<void(uint32_t events)>;
+
+    static std::shared_ptr<EventLoop> Create(std::string name);
+    // the loop shared by the capturer and all the v4l2 codecs.
+    static std::shared_ptr<EventLoop> Shared();
+
+    EventLoop(std::string name);
+    ~EventLoop();
+
+    bool Add(int fd, uint32_t events, EventHandler handler, ErrorHandler on_error = nullptr);
+    bool Modify(int fd, uint32_t events);
+    // the handler is guaranteed not to be running once it returns, unless called from itself.
+    void Remove(int fd);
+    void SetAffinity(int cpu_core);
+    bool IsLoopThread() const;
+
+  private:
+    struct Handlers {
+        EventHandler on_event;
+        ErrorHandler on_error;
+    };
+
+    int epoll_fd_;
+    int wake_fd_;
+    int dispatching_fd_;
+    std::atomic<bool> abort_;
+    std::atomic<int> cpu_core_;
+    std::atomic<bool> is_affinity_changed_;
+    std::atomic<std::thread::id> loop_thread_id_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::unordered_map<int, std::shared_ptr<Handlers>> handlers_;
+    std::unique_ptr<Worker> worker_;
+
+    void Poll();
+    void Dispatch(int fd, uint32_t events);
+    void Wake();
+    void ApplyAffinity();
+};
+
+#endif // EVENT_LOOP_H_
@@ -0,0 +1,151 @@
+#include "common/frame_buffer_pool.h"
+
+#include <algorithm>
+
+#include <rtc_base/memory/aligned_malloc.h>
+
+#include "common/logging.h"
+
+// Aligning pointer to 64 bytes for improved performance, e.g. use SIMD.
+static const int kBufferAlignment = 64;
+static const uint64_t kStatsReportInterval = 1800;
+
+/* An I420Buffer with its own reference count, which goes back to the pool instead of being
+ * deleted when the last holder releases it. */
+class PooledI420Buffer : public webrtc::I420Buffer {
+  public:
+    PooledI420Buffer(std::weak_ptr<FrameBufferPool> pool, int width, int height, int stride_y,
+                     int stride_uv)
+        : webrtc::I420Buffer(width, height, stride_y, stride_uv, stride_uv),
+          pool_(pool),
+          ref_count_(0) {}
+    ~PooledI420Buffer() override = default;
+
+    void AddRef() const override { ref_count_.fetch_add(1, std::memory_order_relaxed); }
+
+    rtc::RefCountReleaseStatus Release() const override {
+        if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return rtc::RefCountReleaseStatus::kOtherRefsRemained;
+        }
+        auto *buffer = const_cast<PooledI420Buffer *>(this);
+        auto pool = pool_.lock();
+        if (!pool || !pool->Recycle(buffer)) {
+            delete buffer;
+        }
+        return rtc::RefCountReleaseStatus::kDroppedLastRef;
+    }
+
+    FrameBufferPool::I420Key key() const {
+        return {width(), height(), StrideY(), StrideU()};
+    }
+
+  private:
+    std::weak_ptr<FrameBufferPool> pool_;
+    mutable std::atomic<int> ref_count_;
+};
+
+std::shared_ptr<FrameBufferPool> FrameBufferPool::Create(size_t max_free_buffers) {
+    return std::make_shared<FrameBufferPool>(max_free_buffers);
+}
+
+std::shared_ptr<FrameBufferPool> FrameBufferPool::Shared() {
+    static std::shared_ptr<FrameBufferPool> pool = Create();
+    return pool;
+}
+
+FrameBufferPool::FrameBufferPool(size_t max_free_buffers)
+    : max_free_buffers_(max_free_buffers),
+      hits_(0),
+      misses_(0) {}
+
+FrameBufferPool::~FrameBufferPool() {
+    for (auto &[_, buffers] : free_i420_buffers_) {
+        for (auto *buffer : buffers) {
+            delete buffer;
+        }
+    }
+    for (auto &[_, buffers] : free_data_) {
+        for (auto *data : buffers) {
+            webrtc::AlignedFree(data);
+        }
+    }
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> FrameBufferPool::CreateI420Buffer(int width, int height) {
+    return CreateI420Buffer(width, height, width, (width + 1) / 2);
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer>
+FrameBufferPool::CreateI420Buffer(int width, int height, int stride_y, int stride_uv) {
+    PooledI420Buffer *buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto &buffers = free_i420_buffers_[{width, height, stride_y, stride_uv}];
+        if (!buffers.empty()) {
+            buffer = buffers.back();
+            buffers.pop_back();
+        }
+        CountRequest(buffer != nullptr);
+    }
+
+    if (!buffer) {
+        buffer = new PooledI420Buffer(weak_from_this(), width, height, stride_y, stride_uv);
+    }
+    return rtc::scoped_refptr<webrtc::I420Buffer>(buffer);
+}
+
+std::shared_ptr<uint8_t> FrameBufferPool::Allocate(size_t size) {
+    uint8_t *data = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto &buffers = free_data_[size];
+        if (!buffers.empty()) {
+            data = buffers.back();
+            buffers.pop_back();
+        }
+        CountRequest(data != nullptr);
+    }
+
+    if (!data) {
+        data = static_cast<uint8_t *>(webrtc::AlignedMalloc(size, kBufferAlignment));
+    }
+
+    auto pool = shared_from_this();
+    return std::shared_ptr<uint8_t>(data, [pool, size](uint8_t *ptr) {
+        pool->Release(size, ptr);
+    });
+}
+
+void FrameBufferPool::Release(size_t size, uint8_t *data) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto &buffers = free_data_[size];
+        if (buffers.size() < max_free_buffers_) {
+            buffers.push_back(data);
+            return;
+        }
+    }
+    webrtc::AlignedFree(data);
+}
+
+bool FrameBufferPool::Recycle(PooledI420Buffer *buffer) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto &buffers = free_i420_buffers_[buffer->key()];
+    if (buffers.size() >= max_free_buffers_) {
+        return false;
+    }
+    buffers.push_back(buffer);
+    return true;
+}
+
+FrameBufferPool::Stats FrameBufferPool::stats() const { return {hits_.load(), misses_.load()}; }
+
+void FrameBufferPool::CountRequest(bool is_hit) {
+    uint64_t hits = is_hit ? ++hits_ : hits_.load();
+    uint64_t misses = is_hit ? misses_.load() : ++misses_;
+
+    if ((hits + misses) % kStatsReportInterval == 0) {
+        DEBUG_PRINT("Frame buffer pool: %llu hits, %llu misses.", (unsigned long long)hits,
+                    (unsigned long long)misses);
+    }
+}
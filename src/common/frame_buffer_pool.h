@@ -0,0 +1,59 @@
+#ifndef FRAME_BUFFER_POOL_H_
+#define FRAME_BUFFER_POOL_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <api/video/i420_buffer.h>
+
+class PooledI420Buffer;
+
+/* Recycles the frame-sized allocations instead of malloc/free on every frame.
+ * A buffer is reused only after all of its holders have released it. */
+class FrameBufferPool : public std::enable_shared_from_this<FrameBufferPool> {
+  public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    static std::shared_ptr<FrameBufferPool> Create(size_t max_free_buffers = 8);
+    // the pool shared by the capturers, tracks and recorders in this process.
+    static std::shared_ptr<FrameBufferPool> Shared();
+
+    FrameBufferPool(size_t max_free_buffers);
+    ~FrameBufferPool();
+
+    // the data is not zero-filled, the caller is expected to overwrite it.
+    rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width, int height);
+    rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width, int height, int stride_y,
+                                                            int stride_uv);
+    std::shared_ptr<uint8_t> Allocate(size_t size);
+
+    // the hits and misses of both kinds of buffers since it's created.
+    Stats stats() const;
+
+  private:
+    friend class PooledI420Buffer;
+
+    using I420Key = std::tuple<int, int, int, int>;
+
+    size_t max_free_buffers_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::mutex mtx_;
+    // the released ones, which nobody refers to any more.
+    std::map<I420Key, std::vector<PooledI420Buffer *>> free_i420_buffers_;
+    std::map<size_t, std::vector<uint8_t *>> free_data_;
+
+    void Release(size_t size, uint8_t *data);
+    // false if it's not kept, then the caller deletes it.
+    bool Recycle(PooledI420Buffer *buffer);
+    void CountRequest(bool is_hit);
+};
+
+#endif // FRAME_BUFFER_POOL_H_
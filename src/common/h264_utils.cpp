@@ -0,0 +1,45 @@
+#include "common/h264_utils.h"
+
+static const uint8_t kNalUnitTypeNonIdr = 1;
+static const uint8_t kNalUnitTypeIdr = 5;
+static const uint8_t kNalUnitTypeSps = 7;
+static const uint8_t kNalUnitTypePps = 8;
+
+H264Util::NalUnits H264Util::Parse(const uint8_t *data, size_t size) {
+    NalUnits units;
+    if (data == nullptr) {
+        return units;
+    }
+
+    // a 4-byte start code ends with the 3-byte one, so it's found as well.
+    for (size_t i = 0; i + 3 < size; i++) {
+        if (data[i] != 0x00 || data[i + 1] != 0x00 || data[i + 2] != 0x01) {
+            continue;
+        }
+        uint8_t nal_unit_type = data[i + 3] & 0x1F;
+        switch (nal_unit_type) {
+            case kNalUnitTypeSps:
+                units.has_sps = true;
+                break;
+            case kNalUnitTypePps:
+                units.has_pps = true;
+                break;
+            case kNalUnitTypeIdr:
+                units.has_idr = true;
+                return units;
+            case kNalUnitTypeNonIdr:
+                return units;
+            default:
+                break;
+        }
+        i += 3;
+    }
+    return units;
+}
+
+bool H264Util::HasIdrSlice(const uint8_t *data, size_t size) { return Parse(data, size).has_idr; }
+
+bool H264Util::IsKeyFrame(const uint8_t *data, size_t size) {
+    auto units = Parse(data, size);
+    return units.has_idr && units.has_sps && units.has_pps;
+}
@@ -0,0 +1,24 @@
+#ifndef H264_UTILS_H_
+#define H264_UTILS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/* The camera and the software encoder frames are annex-b access units. Their parameter sets
+ * come before the first slice, so only the head of a frame is scanned. */
+class H264Util {
+  public:
+    struct NalUnits {
+        bool has_sps = false;
+        bool has_pps = false;
+        bool has_idr = false;
+    };
+
+    // the nal units up to and including the first slice.
+    static NalUnits Parse(const uint8_t *data, size_t size);
+    static bool HasIdrSlice(const uint8_t *data, size_t size);
+    // an idr slice after the sps and pps, where a decoder can start from.
+    static bool IsKeyFrame(const uint8_t *data, size_t size);
+};
+
+#endif // H264_UTILS_H_
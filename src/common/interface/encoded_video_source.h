@@ -0,0 +1,20 @@
+#ifndef ENCODED_VIDEO_SOURCE_H_
+#define ENCODED_VIDEO_SOURCE_H_
+
+#include <memory>
+
+#include "common/interface/subject.h"
+#include "common/v4l2_utils.h"
+
+/* A running h264 encoder, whose bitstream can be consumed as it is instead of encoding the
+ * frames a second time. The buffers are flagged by `V4L2_BUF_FLAG_KEYFRAME` and lease the
+ * encoded data, so they can be queued without a copy. */
+class EncodedVideoSource {
+  public:
+    virtual ~EncodedVideoSource() = default;
+    virtual std::shared_ptr<Observable<V4l2Buffer>> AsEncodedObservable() = 0;
+    // the next frame is encoded as an IDR, e.g. to start a new segment on it.
+    virtual void RequestKeyFrame() = 0;
+};
+
+#endif // ENCODED_VIDEO_SOURCE_H_
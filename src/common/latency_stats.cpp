@@ -0,0 +1,130 @@
+#include "common/latency_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+
+// the bucket bounds grow by 20% from 50 us, the last one covers about 5 seconds.
+static const double kFirstBucketUs = 50.0;
+static const double kBucketGrowth = 1.2;
+
+static int64_t BucketUpperBound(int index) {
+    return static_cast<int64_t>(kFirstBucketUs * std::pow(kBucketGrowth, index));
+}
+
+static int BucketIndex(int64_t duration_us) {
+    if (duration_us <= kFirstBucketUs) {
+        return 0;
+    }
+    int index = std::ceil(std::log(duration_us / kFirstBucketUs) / std::log(kBucketGrowth));
+    return std::min(index, LatencyHistogram::kNumBuckets - 1);
+}
+
+LatencyHistogram::LatencyHistogram()
+    : count_(0),
+      max_(0) {
+    for (auto &bucket : buckets_) {
+        bucket.store(0);
+    }
+}
+
+void LatencyHistogram::Record(int64_t duration_us) {
+    if (duration_us < 0) {
+        return;
+    }
+    buckets_[BucketIndex(duration_us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t max = max_.load(std::memory_order_relaxed);
+    while (duration_us > max &&
+           !max_.compare_exchange_weak(max, duration_us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::RecordSince(const struct timeval &start) {
+    int64_t start_us = LatencyStats::ToUs(start);
+    if (start_us > 0) {
+        Record(LatencyStats::NowUs() - start_us);
+    }
+}
+
+int64_t LatencyHistogram::Percentile(double percentile) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = std::max<uint64_t>(1, std::ceil(total * percentile / 100.0));
+    uint64_t accumulated = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+        accumulated += buckets_[i].load(std::memory_order_relaxed);
+        if (accumulated >= target) {
+            return std::min(BucketUpperBound(i), max());
+        }
+    }
+    return max();
+}
+
+uint64_t LatencyHistogram::count() const { return count_.load(std::memory_order_relaxed); }
+
+int64_t LatencyHistogram::max() const { return max_.load(std::memory_order_relaxed); }
+
+void LatencyHistogram::Reset() {
+    for (auto &bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+std::mutex LatencyStats::mtx_;
+std::map<std::string, std::unique_ptr<LatencyHistogram>> LatencyStats::stages_;
+
+LatencyHistogram &LatencyStats::Stage(const std::string &stage) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto &histogram = stages_[stage];
+    if (!histogram) {
+        histogram = std::make_unique<LatencyHistogram>();
+    }
+    return *histogram;
+}
+
+std::vector<StageLatency> LatencyStats::Snapshot() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::vector<StageLatency> snapshot;
+    for (auto &[stage, histogram] : stages_) {
+        snapshot.push_back({stage, histogram->count(), histogram->Percentile(50),
+                            histogram->Percentile(95), histogram->Percentile(99),
+                            histogram->max()});
+    }
+    return snapshot;
+}
+
+std::string LatencyStats::ToString() {
+    std::string result;
+    char line[256];
+    for (auto &s : Snapshot()) {
+        snprintf(line, sizeof(line), "%-20s n=%-8llu p50=%.1fms p95=%.1fms p99=%.1fms max=%.1fms\n",
+                 s.stage.c_str(), (unsigned long long)s.count, s.p50_us / 1000.0,
+                 s.p95_us / 1000.0, s.p99_us / 1000.0, s.max_us / 1000.0);
+        result += line;
+    }
+    return result;
+}
+
+void LatencyStats::Reset() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto &[_, histogram] : stages_) {
+        histogram->Reset();
+    }
+}
+
+int64_t LatencyStats::NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t LatencyStats::ToUs(const struct timeval &tv) {
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
@@ -0,0 +1,60 @@
+#ifndef LATENCY_STATS_H_
+#define LATENCY_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+/* A fixed-bucket histogram, recording is lock-free and safe from any thread. */
+class LatencyHistogram {
+  public:
+    static const int kNumBuckets = 64;
+
+    LatencyHistogram();
+    void Record(int64_t duration_us);
+    // records the time elapsed since a v4l2 timestamp, the unset ones are ignored.
+    void RecordSince(const struct timeval &start);
+    // the upper bound of the bucket where the percentile falls in.
+    int64_t Percentile(double percentile) const;
+    uint64_t count() const;
+    int64_t max() const;
+    void Reset();
+
+  private:
+    std::array<std::atomic<uint64_t>, kNumBuckets> buckets_;
+    std::atomic<uint64_t> count_;
+    std::atomic<int64_t> max_;
+};
+
+struct StageLatency {
+    std::string stage;
+    uint64_t count;
+    int64_t p50_us;
+    int64_t p95_us;
+    int64_t p99_us;
+    int64_t max_us;
+};
+
+class LatencyStats {
+  public:
+    // the returned histogram lives as long as the process, callers may keep the reference.
+    static LatencyHistogram &Stage(const std::string &stage);
+    static std::vector<StageLatency> Snapshot();
+    static std::string ToString();
+    static void Reset();
+
+    // the same monotonic clock as the v4l2 buffer timestamps.
+    static int64_t NowUs();
+    static int64_t ToUs(const struct timeval &tv);
+
+  private:
+    static std::mutex mtx_;
+    static std::map<std::string, std::unique_ptr<LatencyHistogram>> stages_;
+};
+
+#endif // LATENCY_STATS_H_
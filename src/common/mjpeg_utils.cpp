@@ -0,0 +1,171 @@
+#include "common/mjpeg_utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <numeric>
+
+static const uint8_t kMarkerPrefix = 0xFF;
+static const uint8_t kSoi = 0xD8;
+static const uint8_t kEoi = 0xD9;
+static const uint8_t kSos = 0xDA;
+static const uint8_t kDqt = 0xDB;
+static const uint8_t kDht = 0xC4;
+
+// the luminance quantization table of the jpeg spec (K.1), which libjpeg scales by quality.
+static const uint8_t kStdLuminanceQuantTable[64] = {
+    16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+
+// the default tables of the motion jpeg format (K.3), as a complete DHT segment.
+static const uint8_t kDefaultHuffmanTables[] = {
+    0xFF, 0xC4, 0x01, 0xA2,
+    // luminance dc
+    0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // luminance ac
+    0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00,
+    0x01, 0x7D, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13,
+    0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1,
+    0x15, 0x52, 0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19,
+    0x1A, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43,
+    0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+    0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4,
+    0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA,
+    0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6,
+    0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA,
+    // chrominance dc
+    0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // chrominance ac
+    0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01,
+    0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51,
+    0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09,
+    0x23, 0x33, 0x52, 0xF0, 0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1,
+    0x17, 0x18, 0x19, 0x1A, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A,
+    0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95,
+    0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2,
+    0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8,
+    0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE2, 0xE3, 0xE4, 0xE5,
+    0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA};
+
+static bool IsJpeg(const uint8_t *data, size_t size) {
+    return data && size > 4 && data[0] == kMarkerPrefix && data[1] == kSoi;
+}
+
+using OnSegmentFunc = std::function<bool(uint8_t marker, const uint8_t *payload, size_t length)>;
+
+/* Walks the header segments up to the start of scan. Returns the offset of the scan, or of
+ * the segment where `fn` returned false, and 0 if the data is broken before. */
+static size_t ParseSegments(const uint8_t *data, size_t size, OnSegmentFunc fn) {
+    if (!IsJpeg(data, size)) {
+        return 0;
+    }
+
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != kMarkerPrefix) {
+            return 0;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == kMarkerPrefix) {
+            // a fill byte.
+            pos++;
+            continue;
+        }
+        if (marker == kSos) {
+            return pos;
+        }
+        if (marker == kEoi) {
+            return 0;
+        }
+
+        size_t length = (data[pos + 2] << 8) | data[pos + 3];
+        if (length < 2 || pos + 2 + length > size) {
+            return 0;
+        }
+        if (!fn(marker, data + pos + 4, length - 2)) {
+            return pos;
+        }
+        pos += 2 + length;
+    }
+    return 0;
+}
+
+int MjpegUtil::EstimateQuality(const uint8_t *data, size_t size) {
+    static const int kStdSum = std::accumulate(std::begin(kStdLuminanceQuantTable),
+                                               std::end(kStdLuminanceQuantTable), 0);
+
+    int sum = -1;
+    ParseSegments(data, size, [&](uint8_t marker, const uint8_t *payload, size_t length) {
+        if (marker != kDqt) {
+            return true;
+        }
+        // a segment may carry several tables, each is 8 or 16 bits per element.
+        size_t pos = 0;
+        while (pos < length) {
+            int precision = payload[pos] >> 4;
+            int id = payload[pos] & 0x0F;
+            size_t table_size = precision ? 128 : 64;
+            if (pos + 1 + table_size > length) {
+                return false;
+            }
+            if (id == 0) {
+                sum = 0;
+                for (int i = 0; i < 64; i++) {
+                    const uint8_t *element = payload + pos + 1 + (precision ? i * 2 : i);
+                    sum += precision ? (element[0] << 8) | element[1] : element[0];
+                }
+                return false;
+            }
+            pos += 1 + table_size;
+        }
+        return true;
+    });
+
+    if (sum <= 0) {
+        return -1;
+    }
+    // invert the scaling of jpeg_set_quality().
+    int scale = (sum * 100 + kStdSum / 2) / kStdSum;
+    int quality = scale <= 100 ? (200 - scale) / 2 : 5000 / scale;
+    return std::clamp(quality, 1, 100);
+}
+
+Buffer MjpegUtil::ToJpeg(const uint8_t *data, size_t size) {
+    Buffer jpeg_buffer;
+    jpeg_buffer.length = 0;
+
+    bool has_dht = false;
+    size_t offset = ParseSegments(data, size, [&](uint8_t marker, const uint8_t *, size_t) {
+        has_dht = marker == kDht;
+        return !has_dht;
+    });
+    if (offset == 0) {
+        return jpeg_buffer;
+    }
+
+    size_t extra_size = has_dht ? 0 : sizeof(kDefaultHuffmanTables);
+    jpeg_buffer.start.reset(static_cast<uint8_t *>(malloc(size + extra_size)));
+    if (!jpeg_buffer.start) {
+        return jpeg_buffer;
+    }
+
+    uint8_t *dst = jpeg_buffer.start.get();
+    if (has_dht) {
+        memcpy(dst, data, size);
+    } else {
+        // stopped at the scan, any place before it is fine for the tables.
+        memcpy(dst, data, offset);
+        memcpy(dst + offset, kDefaultHuffmanTables, extra_size);
+        memcpy(dst + offset + extra_size, data + offset, size - offset);
+    }
+    jpeg_buffer.length = size + extra_size;
+    return jpeg_buffer;
+}
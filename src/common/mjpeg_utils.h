@@ -0,0 +1,19 @@
+#ifndef MJPEG_UTILS_H_
+#define MJPEG_UTILS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "common/utils.h"
+
+/* The frames of the usb webcams are baseline jpegs, but many of them leave out the huffman
+ * tables and rely on the default ones of the motion jpeg spec, which the browsers don't. */
+class MjpegUtil {
+  public:
+    // the libjpeg quality which would produce the luma quantization table, -1 if there's none.
+    static int EstimateQuality(const uint8_t *data, size_t size);
+    // copies the frame into a standalone jpeg, with the default huffman tables if needed.
+    static Buffer ToJpeg(const uint8_t *data, size_t size);
+};
+
+#endif // MJPEG_UTILS_H_
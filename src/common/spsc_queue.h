@@ -0,0 +1,58 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+/* A bounded lock-free ring for exactly one producer thread and one consumer thread.
+ * The storage is allocated once in reset(), which must not race with push() or pop(). */
+template <typename T> class SpscQueue {
+  public:
+    SpscQueue(size_t capacity = 0) { reset(capacity); }
+
+    void reset(size_t capacity) {
+        // one slot is kept empty to tell a full ring from an empty one.
+        buffer_.assign(capacity + 1, T());
+        head_.store(0);
+        tail_.store(0);
+    }
+
+    bool push(const T &value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % buffer_.size();
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        buffer_[tail] = value;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = buffer_[head];
+        head_.store((head + 1) % buffer_.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        return (tail + buffer_.size() - head) % buffer_.size();
+    }
+
+  private:
+    std::vector<T> buffer_;
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif // SPSC_QUEUE_H_
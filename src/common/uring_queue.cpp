@@ -0,0 +1,189 @@
+#include "common/uring_queue.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/logging.h"
+
+static const unsigned int kQueueDepth = 256;
+static const int kWaitTimeoutMs = 500;
+
+UringQueue *UringQueue::Instance() {
+    static std::unique_ptr<UringQueue> instance = []() -> std::unique_ptr<UringQueue> {
+        auto queue = std::make_unique<UringQueue>();
+        if (!queue->is_ready_) {
+            return nullptr;
+        }
+        return queue;
+    }();
+    return instance.get();
+}
+
+UringQueue::UringQueue()
+    : is_ready_(false),
+      has_unlink_(false) {
+    int ret = io_uring_queue_init(kQueueDepth, &ring_, 0);
+    if (ret < 0) {
+        ERROR_PRINT("io_uring is not available (%s), use the blocking io.", strerror(-ret));
+        return;
+    }
+
+    // the ops used here came with 5.6, except unlinkat with 5.11. The reaper waits without
+    // submitting a timeout, which needs 5.11, so it doesn't race with the submitters.
+    io_uring_probe *probe = io_uring_get_probe_ring(&ring_);
+    if (probe && (ring_.features & IORING_FEAT_EXT_ARG)) {
+        is_ready_ = io_uring_opcode_supported(probe, IORING_OP_WRITE) &&
+                    io_uring_opcode_supported(probe, IORING_OP_FALLOCATE);
+        has_unlink_ = io_uring_opcode_supported(probe, IORING_OP_UNLINKAT);
+    }
+    if (probe) {
+        io_uring_free_probe(probe);
+    }
+    if (!is_ready_) {
+        ERROR_PRINT("io_uring lacks the file ops, use the blocking io.");
+        io_uring_queue_exit(&ring_);
+        return;
+    }
+
+    worker_.reset(new Worker("IoUring", [this]() {
+        Reap();
+    }));
+    worker_->Run();
+}
+
+UringQueue::~UringQueue() {
+    if (is_ready_) {
+        worker_.reset();
+        io_uring_queue_exit(&ring_);
+    }
+}
+
+bool UringQueue::Write(int fd, const void *buf, size_t size, int64_t offset,
+                       OnCompleteFunc fn) {
+    std::vector<std::unique_ptr<Request>> requests;
+    requests.emplace_back(new Request{Request::kWrite, fd, buf, size, offset, 0, "", fn});
+    return Submit(std::move(requests));
+}
+
+bool UringQueue::Fallocate(int fd, int mode, int64_t offset, int64_t size, OnCompleteFunc fn) {
+    std::vector<std::unique_ptr<Request>> requests;
+    requests.emplace_back(
+        new Request{Request::kFallocate, fd, nullptr, (size_t)size, offset, mode, "", fn});
+    return Submit(std::move(requests));
+}
+
+bool UringQueue::Fdatasync(int fd, OnCompleteFunc fn) {
+    std::vector<std::unique_ptr<Request>> requests;
+    requests.emplace_back(new Request{Request::kFdatasync, fd, nullptr, 0, 0, 0, "", fn});
+    return Submit(std::move(requests));
+}
+
+bool UringQueue::Unlink(const std::string &path, bool is_dir, OnCompleteFunc fn) {
+    std::vector<std::unique_ptr<Request>> requests;
+    requests.emplace_back(new Request{Request::kUnlink, AT_FDCWD, nullptr, 0, 0,
+                                      is_dir ? AT_REMOVEDIR : 0, path, fn});
+    return Submit(std::move(requests));
+}
+
+int UringQueue::UnlinkAll(const std::vector<std::string> &paths, bool is_dir) {
+    struct State {
+        std::mutex mtx;
+        std::condition_variable cond;
+        size_t remaining;
+        int removed;
+    };
+    auto state = std::make_shared<State>();
+    state->remaining = paths.size();
+    state->removed = 0;
+
+    std::vector<std::unique_ptr<Request>> requests;
+    for (const auto &path : paths) {
+        requests.emplace_back(new Request{Request::kUnlink, AT_FDCWD, nullptr, 0, 0,
+                                          is_dir ? AT_REMOVEDIR : 0, path, [state](int result) {
+                                              std::lock_guard<std::mutex> lock(state->mtx);
+                                              state->removed += result == 0;
+                                              state->remaining--;
+                                              state->cond.notify_all();
+                                          }});
+    }
+    Submit(std::move(requests));
+
+    std::unique_lock<std::mutex> lock(state->mtx);
+    state->cond.wait(lock, [&state]() { return state->remaining == 0; });
+    return state->removed;
+}
+
+bool UringQueue::Submit(std::vector<std::unique_ptr<Request>> requests) {
+    // every callback is called once, the failed ones right here after unlocking.
+    std::vector<std::pair<std::unique_ptr<Request>, int>> failed;
+    {
+        std::lock_guard<std::mutex> lock(submit_mtx_);
+        for (auto &request : requests) {
+            if (request->op == Request::kUnlink && !has_unlink_) {
+                int ret = unlinkat(AT_FDCWD, request->path.c_str(), request->mode);
+                failed.emplace_back(std::move(request), ret < 0 ? -errno : 0);
+                continue;
+            }
+
+            io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+            if (!sqe) {
+                // the ring is full, hand the queued ones over to make room.
+                io_uring_submit(&ring_);
+                sqe = io_uring_get_sqe(&ring_);
+            }
+            if (!sqe) {
+                failed.emplace_back(std::move(request), -EBUSY);
+                continue;
+            }
+
+            switch (request->op) {
+                case Request::kWrite:
+                    io_uring_prep_write(sqe, request->fd, request->buf, request->size,
+                                        request->offset);
+                    break;
+                case Request::kFallocate:
+                    io_uring_prep_fallocate(sqe, request->fd, request->mode, request->offset,
+                                            request->size);
+                    break;
+                case Request::kFdatasync:
+                    io_uring_prep_fsync(sqe, request->fd, IORING_FSYNC_DATASYNC);
+                    // the writes submitted before it complete first, or it may sync none.
+                    io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+                    break;
+                case Request::kUnlink:
+                    io_uring_prep_unlinkat(sqe, AT_FDCWD, request->path.c_str(), request->mode);
+                    break;
+            }
+            io_uring_sqe_set_data(sqe, request.release());
+        }
+        io_uring_submit(&ring_);
+    }
+
+    for (auto &[request, result] : failed) {
+        if (request->fn) {
+            request->fn(result);
+        }
+    }
+    return failed.empty();
+}
+
+void UringQueue::Reap() {
+    io_uring_cqe *cqe;
+    __kernel_timespec timeout = {0, kWaitTimeoutMs * 1000000LL};
+    if (io_uring_wait_cqe_timeout(&ring_, &cqe, &timeout) < 0) {
+        return;
+    }
+
+    unsigned int head;
+    unsigned int count = 0;
+    io_uring_for_each_cqe(&ring_, head, cqe) {
+        std::unique_ptr<Request> request(static_cast<Request *>(io_uring_cqe_get_data(cqe)));
+        if (request && request->fn) {
+            request->fn(cqe->res);
+        }
+        count++;
+    }
+    io_uring_cq_advance(&ring_, count);
+}
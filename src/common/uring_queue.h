@@ -0,0 +1,58 @@
+#ifndef URING_QUEUE_H_
+#define URING_QUEUE_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <liburing.h>
+
+#include "common/worker.h"
+
+/* An io_uring shared by the file io of the process, built with `USE_IO_URING`. Submitting is
+ * thread-safe, the completions are reaped and their callbacks are called on its own thread,
+ * so they should only hand the result over. */
+class UringQueue {
+  public:
+    // the result is the one of the syscall, or -errno.
+    using OnCompleteFunc = std::function<void(int result)>;
+
+    // nullptr if the kernel doesn't support io_uring, the callers fall back to the syscalls.
+    static UringQueue *Instance();
+
+    UringQueue();
+    ~UringQueue();
+
+    bool Write(int fd, const void *buf, size_t size, int64_t offset, OnCompleteFunc fn);
+    bool Fallocate(int fd, int mode, int64_t offset, int64_t size, OnCompleteFunc fn);
+    bool Fdatasync(int fd, OnCompleteFunc fn);
+    bool Unlink(const std::string &path, bool is_dir, OnCompleteFunc fn);
+    // submits them at once and waits, returns the number of the removed ones.
+    int UnlinkAll(const std::vector<std::string> &paths, bool is_dir = false);
+
+  private:
+    struct Request {
+        enum Op { kWrite, kFallocate, kFdatasync, kUnlink } op;
+        int fd;
+        const void *buf;
+        size_t size;
+        int64_t offset;
+        int mode;
+        // kept alive until the kernel has resolved it.
+        std::string path;
+        OnCompleteFunc fn;
+    };
+
+    struct io_uring ring_;
+    bool is_ready_;
+    bool has_unlink_;
+    std::mutex submit_mtx_;
+    std::unique_ptr<Worker> worker_;
+
+    bool Submit(std::vector<std::unique_ptr<Request>> requests);
+    void Reap();
+};
+
+#endif // URING_QUEUE_H_
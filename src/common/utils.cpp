@@ -1,14 +1,23 @@
 #include "common/utils.h"
 
 #include <algorithm>
+#include <array>
+#include <unistd.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 
 extern "C" {
 #include <libavformat/avformat.h>
 }
 #include <jpeglib.h>
-#include <third_party/libyuv/include/libyuv.h>
 
+#include "common/frame_buffer_pool.h"
 #include "common/logging.h"
+#if defined(USE_IO_URING)
+#include "common/uring_queue.h"
+#endif
 
 bool Utils::CreateFolder(const std::string &folder_path) {
     if (folder_path.empty()) {
@@ -64,16 +73,12 @@ void Utils::RotateFiles(const std::string &folder_path) {
                 std::sort(mp4_files.begin(), mp4_files.end(), [](const fs::path &a, const fs::path &b) {
                     return fs::last_write_time(a) < fs::last_write_time(b);
                 });
-                fs::remove(mp4_files.front());
-                std::cout << "Deleted oldest .mp4 file: " << mp4_files.front() << std::endl;
-
-                // Also delete corresponding .jpg file
-                fs::path corresponding_image = mp4_files.front().replace_extension(".jpg");
-                if (fs::exists(corresponding_image)) {
-                    fs::remove(corresponding_image);
-                    std::cout << "Deleted corresponding .jpg file: " << corresponding_image
-                              << std::endl;
-                }
+                // the image and the metadata go with the video.
+                fs::path oldest_file = mp4_files.front();
+                RemoveFiles({oldest_file.string(),
+                             fs::path(oldest_file).replace_extension(".jpg").string(),
+                             fs::path(oldest_file).replace_extension(".json").string()});
+                std::cout << "Deleted oldest .mp4 file: " << oldest_file << std::endl;
 
                 if (fs::is_empty(oldest_hour_folder)) {
                     fs::remove(oldest_hour_folder);
@@ -93,6 +98,19 @@ void Utils::RotateFiles(const std::string &folder_path) {
     }
 }
 
+int Utils::RemoveFiles(const std::vector<std::string> &paths) {
+#if defined(USE_IO_URING)
+    if (auto *uring = UringQueue::Instance()) {
+        return uring->UnlinkAll(paths);
+    }
+#endif
+    int removed = 0;
+    for (const auto &path : paths) {
+        removed += unlink(path.c_str()) == 0;
+    }
+    return removed;
+}
+
 std::string Utils::ToBase64(const std::string &binary_file) {
     std::string out;
     int val = 0, valb = -6;
@@ -125,118 +143,6 @@ std::string Utils::ReadFileInBinary(const std::string &file_path) {
     return ss.str();
 }
 
-std::vector<std::pair<fs::file_time_type, fs::path>> Utils::GetFiles(const std::string &path,
-                                                                     const std::string &extension) {
-    std::vector<std::pair<fs::file_time_type, fs::path>> files;
-    for (const auto &entry : fs::directory_iterator(path)) {
-        if (entry.is_regular_file() && entry.path().extension() == extension) {
-            files.emplace_back(fs::last_write_time(entry), entry.path());
-        }
-    }
-    return files;
-}
-
-std::string Utils::FindLatestSubDir(const std::string &path) {
-    std::string latestDir;
-    for (const auto &entry : fs::directory_iterator(path)) {
-        if (entry.is_directory()) {
-            if (entry.path().filename().string() > latestDir) {
-                latestDir = entry.path().filename().string();
-            }
-        }
-    }
-    return latestDir;
-}
-
-std::string Utils::GetPreviousDate(const std::string &dateStr) {
-    std::tm tm = {};
-    std::istringstream ss(dateStr);
-    ss >> std::get_time(&tm, "%Y%m%d");
-
-    tm.tm_mday -= 1;
-    mktime(&tm);
-
-    std::ostringstream oss;
-    oss << std::put_time(&tm, "%Y%m%d");
-
-    return oss.str();
-}
-
-std::string Utils::FindLatestFile(const std::string &path, const std::string &extension) {
-    std::string latestDateDir = Utils::FindLatestSubDir(path);
-    if (latestDateDir.empty()) {
-        std::cerr << "No date directories found." << std::endl;
-        return "";
-    }
-
-    std::string datePath = path + "/" + latestDateDir;
-    std::string latestHourDir = Utils::FindLatestSubDir(datePath);
-    if (latestHourDir.empty()) {
-        std::cerr << "No hour directories found." << std::endl;
-        return "";
-    }
-
-    std::string latestDir = datePath + "/" + latestHourDir;
-    auto files = Utils::GetFiles(latestDir, extension);
-    std::sort(files.begin(), files.end(), std::greater<>());
-
-    return files[0].second.string();
-}
-
-std::string Utils::FindSecondNewestFile(const std::string &path, const std::string &extension) {
-    std::string latestDateDir = Utils::FindLatestSubDir(path);
-    if (latestDateDir.empty()) {
-        std::cerr << "No date directories found." << std::endl;
-        return "";
-    }
-
-    std::string datePath = path + "/" + latestDateDir;
-    std::string latestHourDir = Utils::FindLatestSubDir(datePath);
-    if (latestHourDir.empty()) {
-        std::cerr << "No hour directories found." << std::endl;
-        return "";
-    }
-
-    std::string latestDir = datePath + "/" + latestHourDir;
-    auto files = Utils::GetFiles(latestDir, extension);
-
-    // find previous hour
-    if (files.size() < 2) {
-        std::string prevHourDir = latestHourDir;
-        if (!prevHourDir.empty() && prevHourDir > "00") {
-            prevHourDir = std::to_string(std::stoi(prevHourDir) - 1);
-            if (prevHourDir.length() < 2) {
-                prevHourDir = "0" + prevHourDir;
-            }
-            std::string prevDir = datePath + "/" + prevHourDir;
-            auto prevFiles = Utils::GetFiles(prevDir, extension);
-
-            files.insert(files.end(), prevFiles.begin(), prevFiles.end());
-        }
-    }
-
-    // find previous date
-    if (files.size() < 2) {
-        std::string prevDateDir = Utils::GetPreviousDate(latestDateDir);
-
-        std::string prevDatePath = path + "/" + prevDateDir;
-        latestHourDir = Utils::FindLatestSubDir(prevDatePath);
-        std::string prevDir = prevDatePath + "/" + latestHourDir;
-        auto prevFiles = Utils::GetFiles(prevDir, extension);
-
-        files.insert(files.end(), prevFiles.begin(), prevFiles.end());
-    }
-
-    std::sort(files.begin(), files.end(), std::greater<>());
-
-    if (files.size() < 2) {
-        std::cerr << "Not enough files to determine the second newest file." << std::endl;
-        return "";
-    }
-
-    return files[1].second.string();
-}
-
 std::chrono::system_clock::time_point Utils::ParseDatetime(const std::string &datetime_str) {
     std::tm tm = {};
     std::stringstream ss(datetime_str);
@@ -245,123 +151,6 @@ std::chrono::system_clock::time_point Utils::ParseDatetime(const std::string &da
     return std::chrono::system_clock::from_time_t(std::mktime(&tm));
 }
 
-std::string Utils::FindFilesFromDatetime(const std::string &root, const std::string &basename) {
-    if (basename.length() < 15) {
-        return "";
-    }
-
-    std::string date = basename.substr(0, 8);
-    std::string time = basename.substr(9);
-    std::string hour = time.substr(0, 2);
-
-    fs::path hour_path(root + date + "/" + hour);
-
-    if (!fs::exists(hour_path)) {
-        return "";
-    }
-
-    auto time_limit = ParseDatetime(basename);
-
-    auto files = GetFiles(hour_path.string(), ".mp4");
-    std::sort(files.begin(), files.end(), std::greater<>());
-
-    int max_searching_folder = 10;
-    for (int count = 0; count < max_searching_folder; count++) {
-        // find in the same hour
-        auto files = GetFiles(hour_path.string(), ".mp4");
-        std::sort(files.begin(), files.end(), std::greater<>());
-
-        for (auto &p : files) {
-            std::cout << p.second.string() << std::endl;
-            if (fs::file_time_type::clock::to_sys(p.first) < time_limit) {
-                return p.second.string();
-            }
-        }
-
-        fs::path date_path = hour_path.parent_path();
-        if (hour > "00") {
-            // update hour path to previous hour
-            auto prev_hour = std::to_string(std::stoi(hour) - 1);
-            if (prev_hour.length() < 2) {
-                prev_hour = "0" + prev_hour;
-            }
-            hour_path = date_path / prev_hour;
-            if (!fs::exists(hour_path)) {
-                std::cout << "pre hour path " << hour_path.string() << " is not found" << std::endl;
-                break;
-            }
-        } else {
-            // update date path to previous date
-            fs::path root_path = date_path.parent_path();
-            std::string date = date_path.filename();
-            auto prev_date = GetPreviousDate(date);
-            date_path = root_path / prev_date;
-            hour_path = date_path / "23";
-            if (!fs::exists(date_path)) {
-                std::cout << "pre date path " << date_path.string() << " is not found" << std::endl;
-                break;
-            }
-        }
-    }
-
-    return "";
-}
-
-std::vector<std::string> Utils::FindOlderFiles(const std::string &file_path, int request_num) {
-    std::vector<std::string> result;
-    fs::path file(file_path);
-    if (!fs::exists(file)) {
-        return result;
-    }
-    auto file_last_write_time = fs::last_write_time(file);
-    auto extension = file.extension();
-
-    fs::path hour_path = file.parent_path();
-    fs::path date_path = hour_path.parent_path();
-    fs::path root_path = date_path.parent_path();
-
-    while (result.size() < request_num) {
-        // find in the same hour
-        auto files = GetFiles(hour_path.string(), extension.string());
-        std::sort(files.begin(), files.end(), std::greater<>());
-
-        for (auto &p : files) {
-            if (p.first < file_last_write_time) {
-                result.push_back(p.second.string());
-                if (result.size() == request_num) {
-                    return result;
-                }
-            }
-        }
-
-        std::string hour = hour_path.filename();
-        if (hour > "00") {
-            // update hour path to previous hour
-            auto prev_hour = std::to_string(std::stoi(hour) - 1);
-            if (prev_hour.length() < 2) {
-                prev_hour = "0" + prev_hour;
-            }
-            hour_path = date_path / prev_hour;
-            if (!fs::exists(hour_path)) {
-                std::cout << "pre hour path " << hour_path.string() << " is not found" << std::endl;
-                break;
-            }
-        } else {
-            // update date path to previous date
-            std::string date = date_path.filename();
-            auto prev_date = GetPreviousDate(date);
-            date_path = root_path / prev_date;
-            hour_path = date_path / "23";
-            if (!fs::exists(date_path)) {
-                std::cout << "pre date path " << date_path.string() << " is not found" << std::endl;
-                break;
-            }
-        }
-    }
-
-    return result;
-}
-
 bool Utils::CheckDriveSpace(const std::string &file_path, unsigned long min_free_byte) {
     struct statvfs stat;
     if (statvfs(file_path.c_str(), &stat) != 0) {
@@ -397,14 +186,25 @@ FileInfo Utils::GenerateFilename() {
     return info;
 }
 
-Buffer Utils::ConvertYuvToJpeg(const uint8_t *yuv_data, int width, int height, int quality) {
+/* libjpeg keeps its memory pools between the images, so each thread sets up one only once. */
+struct JpegCompressor {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
 
-    Buffer jpegBuffer;
+    JpegCompressor() {
+        cinfo.err = jpeg_std_error(&jerr);
+        jpeg_create_compress(&cinfo);
+    }
+    ~JpegCompressor() { jpeg_destroy_compress(&cinfo); }
+};
+
+static Buffer EncodeI420Jpeg(const uint8_t *src_y, int stride_y, const uint8_t *src_u,
+                             int stride_u, const uint8_t *src_v, int stride_v, int width,
+                             int height, int quality) {
+    thread_local JpegCompressor compressor;
+    thread_local std::vector<uint8_t> padded_rows;
+    auto &cinfo = compressor.cinfo;
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
     uint8_t *data = nullptr;
     unsigned long size = 0;
     jpeg_mem_dest(&cinfo, &data, &size);
@@ -412,33 +212,104 @@ Buffer Utils::ConvertYuvToJpeg(const uint8_t *yuv_data, int width, int height, i
     cinfo.image_width = width;
     cinfo.image_height = height;
     cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_EXT_BGR;
-
+    cinfo.in_color_space = JCS_YCbCr;
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, quality, TRUE);
 
-    JSAMPROW row_pointer[1];
-    int row_stride = width * 3;
-    uint8_t *rgb_data = (uint8_t *)malloc(width * height * 3);
-    libyuv::I420ToRGB24(yuv_data, width, yuv_data + width * height, width / 2,
-                        yuv_data + width * height + (width * height / 4), width / 2, rgb_data,
-                        width * 3, width, height);
+    // feed the planes as they are, in the 4:2:0 layout of i420.
+    cinfo.raw_data_in = TRUE;
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    for (int i = 1; i < 3; i++) {
+        cinfo.comp_info[i].h_samp_factor = 1;
+        cinfo.comp_info[i].v_samp_factor = 1;
+    }
 
-    jpeg_start_compress(&cinfo, TRUE);
+    // a call takes a row of MCUs, and every row is read up to the width of the MCUs.
+    const int mcu_size = 2 * DCTSIZE;
+    const int chroma_width = (width + 1) / 2;
+    const int chroma_height = (height + 1) / 2;
+    const int padded_width = (width + mcu_size - 1) / mcu_size * mcu_size;
+    const bool is_padded = padded_width != width;
+    if (is_padded) {
+        padded_rows.resize(padded_width * (mcu_size + DCTSIZE));
+    }
 
+    auto get_row = [&](const uint8_t *src, int length, int slot, int slot_width) -> JSAMPROW {
+        if (!is_padded) {
+            return const_cast<JSAMPROW>(src);
+        }
+        // repeat the last pixel, so it's never read beyond the frame.
+        uint8_t *row = padded_rows.data() + slot * slot_width;
+        memcpy(row, src, length);
+        memset(row + length, src[length - 1], slot_width - length);
+        return row;
+    };
+
+    JSAMPROW y_rows[mcu_size];
+    JSAMPROW u_rows[DCTSIZE];
+    JSAMPROW v_rows[DCTSIZE];
+    JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+
+    jpeg_start_compress(&cinfo, TRUE);
     while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &rgb_data[cinfo.next_scanline * row_stride];
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        int row = cinfo.next_scanline;
+        // the rows beyond the bottom repeat the last one.
+        for (int i = 0; i < mcu_size; i++) {
+            y_rows[i] =
+                get_row(src_y + std::min(row + i, height - 1) * stride_y, width, i, padded_width);
+        }
+        for (int i = 0; i < DCTSIZE; i++) {
+            int chroma_row = std::min(row / 2 + i, chroma_height - 1);
+            u_rows[i] = get_row(src_u + chroma_row * stride_u, chroma_width, 2 * mcu_size + i,
+                                padded_width / 2);
+            v_rows[i] = get_row(src_v + chroma_row * stride_v, chroma_width,
+                                2 * mcu_size + DCTSIZE + i, padded_width / 2);
+        }
+        jpeg_write_raw_data(&cinfo, planes, mcu_size);
     }
-
     jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-    free(rgb_data);
 
-    jpegBuffer.start = std::unique_ptr<uint8_t, FreeDeleter>(data);
-    jpegBuffer.length = size;
+    Buffer jpeg_buffer;
+    jpeg_buffer.start = std::unique_ptr<uint8_t, FreeDeleter>(data);
+    jpeg_buffer.length = size;
+    return jpeg_buffer;
+}
 
-    return jpegBuffer;
+Buffer Utils::ConvertYuvToJpeg(const uint8_t *yuv_data, int width, int height, int quality) {
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    const uint8_t *src_u = yuv_data + width * height;
+    const uint8_t *src_v = src_u + chroma_width * chroma_height;
+    return EncodeI420Jpeg(yuv_data, width, src_u, chroma_width, src_v, chroma_width, width,
+                          height, quality);
+}
+
+Buffer Utils::ConvertI420ToJpeg(rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer,
+                                int quality, int width, int height) {
+    if (!i420_buffer || i420_buffer->width() <= 0 || i420_buffer->height() <= 0) {
+        ERROR_PRINT("No image to be converted to jpeg.");
+        return {};
+    }
+
+    if (width > 0 && height <= 0) {
+        height = (int64_t)i420_buffer->height() * width / i420_buffer->width();
+    } else if (height > 0 && width <= 0) {
+        width = (int64_t)i420_buffer->width() * height / i420_buffer->height();
+    }
+
+    if (width > 0 && height > 0 &&
+        (width < i420_buffer->width() || height < i420_buffer->height())) {
+        // the chroma planes are half the size, so a side is even and at least 2.
+        auto scaled_buffer = FrameBufferPool::Shared()->CreateI420Buffer(
+            std::max(width & ~1, 2), std::max(height & ~1, 2));
+        scaled_buffer->ScaleFrom(*i420_buffer);
+        i420_buffer = scaled_buffer;
+    }
+
+    return EncodeI420Jpeg(i420_buffer->DataY(), i420_buffer->StrideY(), i420_buffer->DataU(),
+                          i420_buffer->StrideU(), i420_buffer->DataV(), i420_buffer->StrideV(),
+                          i420_buffer->width(), i420_buffer->height(), quality);
 }
 
 void Utils::WriteJpegImage(Buffer buffer, const std::string &url) {
@@ -452,11 +323,13 @@ void Utils::WriteJpegImage(Buffer buffer, const std::string &url) {
     }
 }
 
-void Utils::CreateJpegImage(const uint8_t *yuv_data, int width, int height,
-                            const std::string &url) {
+void Utils::CreateJpegImage(rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer,
+                            const std::string &url, int width) {
     try {
-        auto jpg_buffer = Utils::ConvertYuvToJpeg(yuv_data, width, height, 30);
-        WriteJpegImage(std::move(jpg_buffer), url);
+        auto jpg_buffer = Utils::ConvertI420ToJpeg(i420_buffer, 30, width);
+        if (jpg_buffer.length > 0) {
+            WriteJpegImage(std::move(jpg_buffer), url);
+        }
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
@@ -488,6 +361,85 @@ int Utils::GetVideoDuration(const std::string &filePath) {
     return durationInSeconds;
 }
 
+bool Utils::FindSampleRange(const std::string &path, double start_sec, double duration_sec,
+                            size_t &offset, size_t &length) {
+    AVFormatContext *fmt_ctx = nullptr;
+    if (avformat_open_input(&fmt_ctx, path.c_str(), nullptr, nullptr) != 0) {
+        ERROR_PRINT("Could not open file: %s", path.c_str());
+        return false;
+    }
+
+    // the mp4 demuxer builds the index from the sample table when reading the header.
+    int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (stream_index < 0) {
+        avformat_close_input(&fmt_ctx);
+        return false;
+    }
+    AVStream *stream = fmt_ctx->streams[stream_index];
+    int num_entries = avformat_index_get_entries_count(stream);
+    if (num_entries <= 0) {
+        avformat_close_input(&fmt_ctx);
+        return false;
+    }
+
+    auto to_pts = [stream](double sec) {
+        return av_rescale_q(sec * AV_TIME_BASE, AV_TIME_BASE_Q, stream->time_base) +
+               (stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0);
+    };
+    int first =
+        std::max(av_index_search_timestamp(stream, to_pts(start_sec), AVSEEK_FLAG_BACKWARD), 0);
+    // the range ends at the next keyframe after the duration, or at the end of the samples.
+    // the audio is interleaved in between, so it's included as well.
+    int last = av_index_search_timestamp(stream, to_pts(start_sec + duration_sec), 0);
+
+    int64_t begin = avformat_index_get_entry(stream, first)->pos;
+    int64_t end = 0;
+    if (last > first) {
+        end = avformat_index_get_entry(stream, last)->pos;
+    } else {
+        auto entry = avformat_index_get_entry(stream, num_entries - 1);
+        end = entry->pos + entry->size;
+    }
+    avformat_close_input(&fmt_ctx);
+
+    if (begin < 0 || end <= begin) {
+        return false;
+    }
+    offset = begin;
+    length = end - begin;
+    return true;
+}
+
+uint32_t Utils::Crc32(uint32_t crc, const uint8_t *data, size_t size) {
+    crc = ~crc;
+#if defined(__ARM_FEATURE_CRC32)
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        crc = __crc32d(crc, value);
+    }
+    for (; size > 0; data++, size--) {
+        crc = __crc32b(crc, *data);
+    }
+#else
+    static const auto kTable = []() {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            }
+            table[i] = value;
+        }
+        return table;
+    }();
+    for (; size > 0; data++, size--) {
+        crc = kTable[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+    return ~crc;
+}
+
 std::string Utils::GenerateUuid() {
     uuid_t uuid;
     char uuid_str[37];
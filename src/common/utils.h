@@ -11,6 +11,8 @@
 #include <vector>
 #include <uuid/uuid.h>
 
+#include <api/video/video_frame_buffer.h>
+
 namespace fs = std::filesystem;
 
 struct FreeDeleter {
@@ -39,25 +41,28 @@ class Utils {
     static std::string PrefixZero(int src, int digits);
     static std::string ToBase64(const std::string &binary_file);
     static std::string ReadFileInBinary(const std::string &file_path);
-    static std::vector<std::pair<fs::file_time_type, fs::path>>
-    GetFiles(const std::string &path, const std::string &extension);
-    static std::string FindLatestSubDir(const std::string &path);
-    static std::string GetPreviousDate(const std::string &dateStr);
-    static std::string FindLatestFile(const std::string &path, const std::string &extension);
-    static std::string FindSecondNewestFile(const std::string &path, const std::string &extension);
     static std::chrono::system_clock::time_point ParseDatetime(const std::string &datetime_str);
-    static std::string FindFilesFromDatetime(const std::string &root, const std::string &basename);
-    static std::vector<std::string> FindOlderFiles(const std::string &file_path, int request_num);
 
     static bool CreateFolder(const std::string &folder_path);
     static void RotateFiles(const std::string &folder_path);
+    // unlinks them in one batch, through io_uring if it's built in. Returns the removed count.
+    static int RemoveFiles(const std::vector<std::string> &paths);
     static bool CheckDriveSpace(const std::string &file_path, unsigned long min_free_byte);
     static Buffer ConvertYuvToJpeg(const uint8_t *yuv_data, int width, int height,
                                    int quality = 100);
-    static void CreateJpegImage(const uint8_t *yuv_data, int width, int height,
-                                const std::string &url);
+    // it's downscaled first if a smaller size is given, 0 keeps the aspect ratio.
+    static Buffer ConvertI420ToJpeg(rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer,
+                                    int quality = 100, int width = 0, int height = 0);
+    static void CreateJpegImage(rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer,
+                                const std::string &url, int width = 0);
     static void WriteJpegImage(Buffer buffer, const std::string &url);
     static int GetVideoDuration(const std::string &filePath);
+    // the bytes of the video samples from the keyframe at or before `start_sec` through
+    // `duration_sec`, found in the mp4 sample table.
+    static bool FindSampleRange(const std::string &path, double start_sec, double duration_sec,
+                                size_t &offset, size_t &length);
+    // the zlib compatible crc32, continued from `crc`, 0 to start.
+    static uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size);
 
     static std::string GenerateUuid();
 };
@@ -2,11 +2,9 @@
 
 #include <third_party/libyuv/include/libyuv.h>
 
+#include "common/frame_buffer_pool.h"
 #include "common/logging.h"
 
-// Aligning pointer to 64 bytes for improved performance, e.g. use SIMD.
-static const int kBufferAlignment = 64;
-
 rtc::scoped_refptr<V4l2FrameBuffer> V4l2FrameBuffer::Create(int width, int height, int size,
                                                             uint32_t format) {
     return rtc::make_ref_counted<V4l2FrameBuffer>(width, height, size, format);
@@ -25,8 +23,7 @@ V4l2FrameBuffer::V4l2FrameBuffer(int width, int height, V4l2Buffer buffer, uint3
       flags_(buffer.flags),
       timestamp_(buffer.timestamp),
       buffer_(buffer),
-      is_buffer_copied(false),
-      data_(static_cast<uint8_t *>(webrtc::AlignedMalloc(size_, kBufferAlignment))) {}
+      is_buffer_copied(false) {}
 
 V4l2FrameBuffer::V4l2FrameBuffer(int width, int height, int size, uint32_t format)
     : width_(width),
@@ -36,7 +33,7 @@ V4l2FrameBuffer::V4l2FrameBuffer(int width, int height, int size, uint32_t forma
       flags_(0),
       timestamp_({0, 0}),
       is_buffer_copied(false),
-      data_(static_cast<uint8_t *>(webrtc::AlignedMalloc(size_, kBufferAlignment))) {}
+      data_(FrameBufferPool::Shared()->Allocate(size_)) {}
 
 V4l2FrameBuffer::~V4l2FrameBuffer() {}
 
@@ -55,11 +52,23 @@ unsigned int V4l2FrameBuffer::flags() const { return flags_; }
 timeval V4l2FrameBuffer::timestamp() const { return timestamp_; }
 
 rtc::scoped_refptr<webrtc::I420BufferInterface> V4l2FrameBuffer::ToI420() {
-    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(webrtc::I420Buffer::Create(width_, height_));
-    i420_buffer->InitializeData();
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (i420_buffer_) {
+        return i420_buffer_;
+    }
+
+    if (format_ == V4L2_PIX_FMT_H264) {
+        // the packets are only passed through, the decoded frames come from the track.
+        ERROR_PRINT("The h264 frame buffer can't be converted to i420.");
+        return nullptr;
+    }
+
+    // every pixel is overwritten by the conversion, so the pooled buffer is not zero-filled.
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
+        FrameBufferPool::Shared()->CreateI420Buffer(width_, height_));
 
     if (format_ == V4L2_PIX_FMT_MJPEG) {
-        if (libyuv::ConvertToI420(is_buffer_copied ? data_.get() : (uint8_t *)buffer_.start, size_,
+        if (libyuv::ConvertToI420((const uint8_t *)Data(), size_,
                                   i420_buffer.get()->MutableDataY(), i420_buffer.get()->StrideY(),
                                   i420_buffer.get()->MutableDataU(), i420_buffer.get()->StrideU(),
                                   i420_buffer.get()->MutableDataV(), i420_buffer.get()->StrideV(),
@@ -68,20 +77,33 @@ rtc::scoped_refptr<webrtc::I420BufferInterface> V4l2FrameBuffer::ToI420() {
             ERROR_PRINT("Mjpeg ConvertToI420 Failed");
         }
     } else if (format_ == V4L2_PIX_FMT_YUV420) {
-        memcpy(i420_buffer->MutableDataY(),
-               is_buffer_copied ? data_.get() : (uint8_t *)buffer_.start, size_);
-    } else if (format_ == V4L2_PIX_FMT_H264) {
-        // use hw decoded frame from track.
+        memcpy(i420_buffer->MutableDataY(), Data(), size_);
     }
 
+    i420_buffer_ = i420_buffer;
     return i420_buffer;
 }
 
 void V4l2FrameBuffer::CopyBufferData() {
-    memcpy(data_.get(), (uint8_t *)buffer_.start, size_); 
-    is_buffer_copied=true;
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (is_buffer_copied.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (!data_) {
+        data_ = FrameBufferPool::Shared()->Allocate(size_);
+    }
+    memcpy(data_.get(), (uint8_t *)buffer_.start, size_);
+    is_buffer_copied.store(true, std::memory_order_release);
+    // the mmap buffer is no longer needed once the data has been copied.
+    buffer_.lease.reset();
 }
 
 V4l2Buffer V4l2FrameBuffer::GetRawBuffer() { return buffer_; }
 
-const void *V4l2FrameBuffer::Data() const { return data_.get(); }
+const void *V4l2FrameBuffer::Data() const {
+    // pairs with CopyBufferData(), the copied data is complete once the flag is seen.
+    if (is_buffer_copied.load(std::memory_order_acquire) || !buffer_.start) {
+        return data_.get();
+    }
+    return buffer_.start;
+}
@@ -1,13 +1,14 @@
 #ifndef V4L2_FRAME_BUFFER_H_
 #define V4L2_FRAME_BUFFER_H_
 
+#include <atomic>
 #include <linux/videodev2.h>
+#include <mutex>
 #include <vector>
 
 #include <api/video/i420_buffer.h>
 #include <api/video/video_frame.h>
 #include <common_video/include/video_frame_buffer.h>
-#include <rtc_base/memory/aligned_malloc.h>
 
 #include "common/v4l2_utils.h"
 
@@ -28,6 +29,7 @@ class V4l2FrameBuffer : public webrtc::VideoFrameBuffer {
     unsigned int flags() const;
     timeval timestamp() const;
 
+    // the data is copied only once, later calls are no-ops.
     void CopyBufferData();
     const void *Data() const;
     V4l2Buffer GetRawBuffer();
@@ -43,10 +45,14 @@ class V4l2FrameBuffer : public webrtc::VideoFrameBuffer {
     const uint32_t format_;
     unsigned int size_;
     unsigned int flags_;
-    bool is_buffer_copied;
+    // set once the data is in `data_`, which readers may see without taking the lock.
+    std::atomic<bool> is_buffer_copied;
     timeval timestamp_;
     V4l2Buffer buffer_;
-    const std::unique_ptr<uint8_t, webrtc::AlignedFreeDeleter> data_;
+    std::shared_ptr<uint8_t> data_;
+    // the first consumer pays for the conversion, the others reuse it.
+    rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer_;
+    std::mutex mtx_;
 };
 
 #endif // V4L2_FRAME_BUFFER_H_
@@ -78,7 +78,10 @@ bool V4l2Util::InitBuffer(int fd, V4l2BufferGroup *gbuffer, v4l2_buf_type type,
 
 bool V4l2Util::DequeueBuffer(int fd, v4l2_buffer *buffer) {
     if (ioctl(fd, VIDIOC_DQBUF, buffer) < 0) {
-        ERROR_PRINT("fd(%d) dequeue buffer: %s", fd, strerror(errno));
+        // nonblocking fds report an empty queue with EAGAIN.
+        if (errno != EAGAIN) {
+            ERROR_PRINT("fd(%d) dequeue buffer: %s", fd, strerror(errno));
+        }
         return false;
     }
     return true;
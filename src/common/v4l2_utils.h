@@ -4,6 +4,7 @@
 #include "v4l2_utils.h"
 
 #include <linux/videodev2.h>
+#include <memory>
 #include <stdint.h>
 #include <string>
 #include <unordered_set>
@@ -17,6 +18,8 @@ struct V4l2Buffer {
     struct timeval timestamp = {0, 0};
     struct v4l2_buffer inner;
     struct v4l2_plane plane;
+    // holding it keeps the mmap buffer out of the driver queue, so the data is safe to read.
+    std::shared_ptr<void> lease;
 
     V4l2Buffer() = default;
     V4l2Buffer(void *start, unsigned int length)
@@ -22,20 +22,29 @@
 
 #include "capturer/libcamera_capturer.h"
 #include "capturer/v4l2_capturer.h"
+#include "common/frame_buffer_pool.h"
+#include "common/latency_stats.h"
 #include "common/logging.h"
+#include "common/mjpeg_utils.h"
 #include "common/utils.h"
 #include "customized_video_encoder_factory.h"
+#include "track/raw_h264_track_source.h"
 #include "track/v4l2dma_track_source.h"
 
+// the camera jpeg is sent as it is unless a much lower quality is asked for.
+const int MJPEG_QUALITY_TOLERANCE = 10;
+
 std::shared_ptr<Conductor> Conductor::Create(Args args) {
     auto ptr = std::make_shared<Conductor>(args);
+    ptr->InitializeCapturers();
     ptr->InitializePeerConnectionFactory();
     ptr->InitializeTracks();
     return ptr;
 }
 
 Conductor::Conductor(Args args)
-    : args(args) {}
+    : args(args),
+      is_encoder_hub_running_(false) {}
 
 Args Conductor::config() const { return args; }
 
@@ -43,14 +52,43 @@ std::shared_ptr<PaCapturer> Conductor::AudioSource() const { return audio_captur
 
 std::shared_ptr<VideoCapturer> Conductor::VideoSource() const { return video_capture_source_; }
 
-void Conductor::InitializeTracks() {
-    if (audio_track_ == nullptr && !args.no_audio) {
+std::shared_ptr<EncodedVideoSource> Conductor::StartSharedEncoder() {
+    if (!encoder_hub_ || !video_track_source_) {
+        return nullptr;
+    }
+    if (!is_encoder_hub_running_) {
+        encoder_hub_->StartAlwaysOn(args.fps);
+        video_track_source_->AddOrUpdateSink(encoder_hub_.get(), rtc::VideoSinkWants());
+        // the new senders keep the resolution by AddTracks(), this is for the ones that
+        // don't set a degradation preference.
+        video_track_->set_content_hint(webrtc::VideoTrackInterface::ContentHint::kDetailed);
+        is_encoder_hub_running_ = true;
+    }
+    return encoder_hub_;
+}
+
+void Conductor::SetRecordingCatalog(std::shared_ptr<RecordingCatalog> catalog) {
+    recording_catalog_ = catalog;
+}
+
+void Conductor::SetRecorderManager(std::shared_ptr<RecorderManager> recorder_mgr) {
+    recorder_mgr_ = recorder_mgr;
+}
+
+void Conductor::SetMotionDetector(std::shared_ptr<MotionDetector> motion_detector) {
+    motion_detector_ = motion_detector;
+    motion_observer_ = motion_detector_->AsObservable();
+    motion_observer_->Subscribe([this](MotionEvent event) {
+        OnMotion(event);
+    });
+}
+
+void Conductor::InitializeCapturers() {
+    if (!args.no_audio) {
         audio_capture_source_ = PaCapturer::Create(args);
-        auto options = peer_connection_factory_->CreateAudioSource(cricket::AudioOptions());
-        audio_track_ = peer_connection_factory_->CreateAudioTrack("audio_track", options.get());
     }
 
-    if (video_track_ == nullptr && !args.device.empty()) {
+    if (!args.device.empty()) {
         video_capture_source_ = ([this]() -> std::shared_ptr<VideoCapturer> {
             if (args.use_libcamera) {
                 return LibcameraCapturer::Create(args);
@@ -58,9 +96,20 @@ void Conductor::InitializeTracks() {
                 return V4l2Capturer::Create(args);
             }
         })();
+    }
+}
 
+void Conductor::InitializeTracks() {
+    if (audio_track_ == nullptr && audio_capture_source_) {
+        auto options = peer_connection_factory_->CreateAudioSource(cricket::AudioOptions());
+        audio_track_ = peer_connection_factory_->CreateAudioTrack("audio_track", options.get());
+    }
+
+    if (video_track_ == nullptr && video_capture_source_) {
         video_track_source_ = ([this]() -> rtc::scoped_refptr<ScaleTrackSource> {
-            if (args.hw_accel) {
+            if (video_capture_source_->format() == V4L2_PIX_FMT_H264) {
+                return RawH264TrackSource::Create(video_capture_source_);
+            } else if (args.hw_accel) {
                 return V4l2DmaTrackSource::Create(video_capture_source_);
             } else {
                 return ScaleTrackSource::Create(video_capture_source_);
@@ -96,7 +145,11 @@ void Conductor::AddTracks(rtc::scoped_refptr<webrtc::PeerConnectionInterface> pe
 
         auto video_sender_ = video_res.value();
         webrtc::RtpParameters parameters = video_sender_->GetParameters();
-        parameters.degradation_preference = webrtc::DegradationPreference::MAINTAIN_FRAMERATE;
+        // the shared encoder is also recorded, a peer scaling it down under load would change
+        // the size in the middle of a segment, so it drops the frame rate instead.
+        parameters.degradation_preference =
+            is_encoder_hub_running_ ? webrtc::DegradationPreference::MAINTAIN_RESOLUTION
+                                    : webrtc::DegradationPreference::MAINTAIN_FRAMERATE;
         video_sender_->SetParameters(parameters);
     }
 }
@@ -140,6 +193,15 @@ rtc::scoped_refptr<RtcPeer> Conductor::CreatePeerConnection(PeerConfig peer_conf
         OnRecord(datachannel, msg);
     });
 
+    peer->OnTrigger([this](std::shared_ptr<DataChannelSubject> datachannel, std::string msg) {
+        OnTrigger(datachannel, msg);
+    });
+
+    if (auto datachannel = peer->GetDataChannel()) {
+        std::lock_guard<std::mutex> lock(channels_mtx_);
+        event_channels_.push_back(datachannel);
+    }
+
     AddTracks(peer->GetPeer());
 
     DEBUG_PRINT("Peer connection(%s) is created! ", peer->GetId().c_str());
@@ -148,20 +210,64 @@ rtc::scoped_refptr<RtcPeer> Conductor::CreatePeerConnection(PeerConfig peer_conf
 
 void Conductor::OnSnapshot(std::shared_ptr<DataChannelSubject> datachannel, std::string &msg) {
     try {
+        // `quality [width [height]]`, the size is optional for a downscaled snapshot.
         std::stringstream ss(msg);
-        int num;
-        ss >> num;
-        int quality = ss.fail() ? 100 : num;
+        int quality = 100;
+        int width = 0;
+        int height = 0;
+        if (!(ss >> quality)) {
+            quality = 100;
+        } else if (ss >> width) {
+            ss >> height;
+        }
+
+        if (SendCameraJpeg(datachannel, quality, width, height)) {
+            return;
+        }
 
         auto i420buff = video_capture_source_->GetI420Frame();
-        auto jpg_buffer =
-            Utils::ConvertYuvToJpeg(i420buff->DataY(), args.width, args.height, quality);
+        if (!i420buff) {
+            ERROR_PRINT("No decoded frame is available for the snapshot.");
+            return;
+        }
+        auto jpg_buffer = Utils::ConvertI420ToJpeg(i420buff, quality, width, height);
+        if (jpg_buffer.length == 0) {
+            return;
+        }
         datachannel->Send(std::move(jpg_buffer));
     } catch (const std::exception &e) {
         ERROR_PRINT("%s", e.what());
     }
 }
 
+bool Conductor::SendCameraJpeg(std::shared_ptr<DataChannelSubject> datachannel, int quality,
+                               int width, int height) {
+    // the source knows the size and format it actually captures, the args only asked for them.
+    auto &source = video_capture_source_;
+    if (source->format() != V4L2_PIX_FMT_MJPEG || (width > 0 && width < source->width()) ||
+        (height > 0 && height < source->height())) {
+        return false;
+    }
+
+    auto jpeg_frame = source->GetJpegFrame();
+    if (!jpeg_frame) {
+        return false;
+    }
+    auto data = static_cast<const uint8_t *>(jpeg_frame->Data());
+    // transcoding never improves on the camera's image, it only makes a smaller file.
+    int camera_quality = MjpegUtil::EstimateQuality(data, jpeg_frame->size());
+    if (camera_quality < 0 || quality < camera_quality - MJPEG_QUALITY_TOLERANCE) {
+        return false;
+    }
+
+    auto jpg_buffer = MjpegUtil::ToJpeg(data, jpeg_frame->size());
+    if (jpg_buffer.length == 0) {
+        return false;
+    }
+    datachannel->Send(std::move(jpg_buffer));
+    return true;
+}
+
 void Conductor::OnMetadata(std::shared_ptr<DataChannelSubject> datachannel, std::string &msg) {
     DEBUG_PRINT("OnMetadata msg: %s", msg.c_str());
     json jsonObj = json::parse(msg.c_str());
@@ -170,14 +276,39 @@ void Conductor::OnMetadata(std::shared_ptr<DataChannelSubject> datachannel, std:
     std::string message = jsonObj["message"];
     DEBUG_PRINT("parse meta cmd message => %hhu, %s", cmd, message.c_str());
 
-    if (args.record_path.empty()) {
+    if (cmd == MetadataCommand::STATS) {
+        json stages = json::array();
+        for (const auto &stage : LatencyStats::Snapshot()) {
+            stages.push_back({{"stage", stage.stage},
+                              {"count", stage.count},
+                              {"p50_us", stage.p50_us},
+                              {"p95_us", stage.p95_us},
+                              {"p99_us", stage.p99_us},
+                              {"max_us", stage.max_us}});
+        }
+        auto pool_stats = FrameBufferPool::Shared()->stats();
+        json pool = {{"hits", pool_stats.hits}, {"misses", pool_stats.misses}};
+        auto stats_str = json({{"stages", stages}, {"frame_buffer_pool", pool}}).dump();
+        std::string size_str = std::to_string(stats_str.length());
+
+        datachannel->Send(CommandType::METADATA, (uint8_t *)size_str.c_str(), size_str.length());
+        datachannel->Send(CommandType::METADATA, (uint8_t *)stats_str.c_str(),
+                          stats_str.length());
+        datachannel->Send(CommandType::METADATA, nullptr, 0);
+        return;
+    }
+
+    if (args.record_path.empty() || !recording_catalog_) {
         return;
     }
     try {
         if (cmd == MetadataCommand::LATEST) {
-            auto latest_mp4_path = Utils::FindSecondNewestFile(args.record_path, ".mp4");
-            MetaMessage metadata(latest_mp4_path);
-            auto metadata_str = metadata.ToString();
+            // the segment being recorded is not indexed until it's closed.
+            auto latest = recording_catalog_->Latest();
+            if (!latest) {
+                return;
+            }
+            auto metadata_str = recording_catalog_->ReadMetadata(*latest);
             int file_size = metadata_str.length();
             std::string size_str = std::to_string(file_size);
 
@@ -186,14 +317,10 @@ void Conductor::OnMetadata(std::shared_ptr<DataChannelSubject> datachannel, std:
             datachannel->Send(CommandType::METADATA, (uint8_t *)metadata_str.c_str(), file_size);
             datachannel->Send(CommandType::METADATA, nullptr, 0);
         } else if (cmd == MetadataCommand::OLDER) {
-            if (message.empty()) {
-                message = Utils::FindLatestFile(args.record_path, ".mp4");
-            }
-            auto paths = Utils::FindOlderFiles(message, 8);
+            auto entries = recording_catalog_->FindOlder(message, 8);
 
-            for (auto &path : paths) {
-                MetaMessage metadata(path);
-                auto metadata_str = metadata.ToString();
+            for (auto &entry : entries) {
+                auto metadata_str = recording_catalog_->ReadMetadata(entry);
                 int file_size = metadata_str.length();
                 std::string size_str = std::to_string(file_size);
 
@@ -204,10 +331,15 @@ void Conductor::OnMetadata(std::shared_ptr<DataChannelSubject> datachannel, std:
                 datachannel->Send(CommandType::METADATA, nullptr, 0);
             }
         } else if (cmd == MetadataCommand::SPECIFIC_TIME) {
-            auto path = Utils::FindFilesFromDatetime(args.record_path, message);
+            if (message.length() < 15) {
+                return;
+            }
+            auto entry = recording_catalog_->FindBefore(Utils::ParseDatetime(message));
+            if (!entry) {
+                return;
+            }
 
-            MetaMessage metadata(path);
-            auto metadata_str = metadata.ToString();
+            auto metadata_str = recording_catalog_->ReadMetadata(*entry);
             int file_size = metadata_str.length();
             std::string size_str = std::to_string(file_size);
 
@@ -221,23 +353,68 @@ void Conductor::OnMetadata(std::shared_ptr<DataChannelSubject> datachannel, std:
     }
 }
 
-void Conductor::OnRecord(std::shared_ptr<DataChannelSubject> datachannel, std::string &path) {
+void Conductor::OnRecord(std::shared_ptr<DataChannelSubject> datachannel, std::string &msg) {
     if (args.record_path.empty()) {
         return;
     }
     try {
-        std::ifstream file(path, std::ios::binary | std::ios::ate);
-        if (!file) {
-            ERROR_PRINT("Unable to open file: %s", path.c_str());
+        // the chunks are sent as the channel drains, it returns once the file is queued.
+        auto request = json::parse(msg, nullptr, false);
+        if (!request.is_object()) {
+            // a plain path, the whole file in the enveloped chunks.
+            datachannel->SendFile(msg);
             return;
         }
-        datachannel->Send(file);
-        DEBUG_PRINT("Sent Video: %s", path.c_str());
+
+        // `{"cancel": true}`, `{"path", "offset", "length"}` to resume from the received
+        // bytes, or `{"path", "time", "duration"}` in seconds for the samples around a moment.
+        if (request.value("cancel", false)) {
+            datachannel->Cancel(CommandType::RECORD);
+            return;
+        }
+        std::string path = request.value("path", "");
+        size_t offset = request.value("offset", (size_t)0);
+        size_t length = request.value("length", (size_t)0);
+        if (request.contains("time") &&
+            !Utils::FindSampleRange(path, request.value("time", 0.0),
+                                    request.value("duration", 0.0), offset, length)) {
+            ERROR_PRINT("No samples found at %.3fs in %s", request.value("time", 0.0),
+                        path.c_str());
+            return;
+        }
+        datachannel->SendFile(path, offset, length);
     } catch (const std::exception &e) {
         ERROR_PRINT("%s", e.what());
     }
 }
 
+void Conductor::OnTrigger(std::shared_ptr<DataChannelSubject> datachannel, std::string &reason) {
+    if (!recorder_mgr_) {
+        return;
+    }
+    DEBUG_PRINT("Recording is triggered by the peer: %s", reason.c_str());
+    recorder_mgr_->Trigger();
+}
+
+void Conductor::OnMotion(MotionEvent event) {
+    if (event.is_moving && recorder_mgr_) {
+        recorder_mgr_->Trigger();
+    }
+
+    auto message = event.ToString();
+    std::lock_guard<std::mutex> lock(channels_mtx_);
+    for (auto it = event_channels_.begin(); it != event_channels_.end();) {
+        auto datachannel = it->lock();
+        if (!datachannel) {
+            // the peer has been closed.
+            it = event_channels_.erase(it);
+            continue;
+        }
+        datachannel->Send(CommandType::MOTION, (uint8_t *)message.c_str(), message.length());
+        ++it;
+    }
+}
+
 void Conductor::InitializePeerConnectionFactory() {
     rtc::InitializeSSL();
 
@@ -279,7 +456,10 @@ void Conductor::InitializePeerConnectionFactory() {
     media_dependencies.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
     media_dependencies.audio_processing = webrtc::AudioProcessingBuilder().Create();
     media_dependencies.audio_mixer = nullptr;
-    media_dependencies.video_encoder_factory = CreateCustomizedVideoEncoderFactory(args);
+    auto video_encoder_factory =
+        std::make_unique<CustomizedVideoEncoderFactory>(args, video_capture_source_);
+    encoder_hub_ = video_encoder_factory->EncoderHub();
+    media_dependencies.video_encoder_factory = std::move(video_encoder_factory);
     media_dependencies.video_decoder_factory = std::make_unique<webrtc::VideoDecoderFactoryTemplate<
         webrtc::OpenH264DecoderTemplateAdapter, webrtc::LibvpxVp8DecoderTemplateAdapter,
         webrtc::LibvpxVp9DecoderTemplateAdapter, webrtc::Dav1dDecoderTemplateAdapter>>();
@@ -290,6 +470,9 @@ void Conductor::InitializePeerConnectionFactory() {
 }
 
 Conductor::~Conductor() {
+    if (is_encoder_hub_running_) {
+        video_track_source_->RemoveSink(encoder_hub_.get());
+    }
     audio_track_ = nullptr;
     video_track_ = nullptr;
     video_capture_source_ = nullptr;
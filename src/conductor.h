@@ -5,6 +5,7 @@
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include <api/peer_connection_interface.h>
@@ -13,7 +14,11 @@
 #include "args.h"
 #include "capturer/pa_capturer.h"
 #include "capturer/video_capturer.h"
+#include "motion/motion_detector.h"
+#include "recorder/recorder_manager.h"
+#include "recorder/recording_catalog.h"
 #include "rtc_peer.h"
+#include "shared_video_encoder.h"
 #include "track/scale_track_source.h"
 
 class Conductor {
@@ -27,16 +32,26 @@ class Conductor {
     rtc::scoped_refptr<RtcPeer> CreatePeerConnection(PeerConfig peer_config);
     std::shared_ptr<PaCapturer> AudioSource() const;
     std::shared_ptr<VideoCapturer> VideoSource() const;
+    // keeps the shared encoder running for the recorder, nullptr if it's not enabled.
+    std::shared_ptr<EncodedVideoSource> StartSharedEncoder();
+    void SetRecordingCatalog(std::shared_ptr<RecordingCatalog> catalog);
+    void SetRecorderManager(std::shared_ptr<RecorderManager> recorder_mgr);
+    void SetMotionDetector(std::shared_ptr<MotionDetector> motion_detector);
 
   private:
     Args args;
 
+    void InitializeCapturers();
     void InitializePeerConnectionFactory();
     void InitializeTracks();
     void AddTracks(rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection);
     void OnSnapshot(std::shared_ptr<DataChannelSubject> datachannel, std::string &msg);
+    bool SendCameraJpeg(std::shared_ptr<DataChannelSubject> datachannel, int quality, int width,
+                        int height);
     void OnMetadata(std::shared_ptr<DataChannelSubject> datachannel, std::string &path);
-    void OnRecord(std::shared_ptr<DataChannelSubject> datachannel, std::string &path);
+    void OnRecord(std::shared_ptr<DataChannelSubject> datachannel, std::string &msg);
+    void OnTrigger(std::shared_ptr<DataChannelSubject> datachannel, std::string &reason);
+    void OnMotion(MotionEvent event);
 
     std::unique_ptr<rtc::Thread> network_thread_;
     std::unique_ptr<rtc::Thread> worker_thread_;
@@ -44,6 +59,15 @@ class Conductor {
 
     std::shared_ptr<PaCapturer> audio_capture_source_;
     std::shared_ptr<VideoCapturer> video_capture_source_;
+    std::shared_ptr<VideoEncoderHub> encoder_hub_;
+    bool is_encoder_hub_running_;
+    std::shared_ptr<RecordingCatalog> recording_catalog_;
+    std::shared_ptr<RecorderManager> recorder_mgr_;
+    std::shared_ptr<MotionDetector> motion_detector_;
+    std::shared_ptr<Observable<MotionEvent>> motion_observer_;
+    // the channels of the connected peers, which are notified of the motion events.
+    std::mutex channels_mtx_;
+    std::vector<std::weak_ptr<DataChannelSubject>> event_channels_;
     rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peer_connection_factory_;
     rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
     rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
@@ -1,21 +1,49 @@
 #include "customized_video_encoder_factory.h"
 
+#include <media/base/media_constants.h>
 #include <modules/video_coding/codecs/h264/include/h264.h>
 #include <modules/video_coding/codecs/av1/av1_svc_config.h>
 #include <modules/video_coding/codecs/av1/libaom_av1_encoder.h>
 #include <modules/video_coding/codecs/vp8/include/vp8.h>
 #include <modules/video_coding/codecs/vp9/include/vp9.h>
 
+#include "v4l2_codecs/raw_h264_encoder.h"
 #include "v4l2_codecs/v4l2_h264_encoder.h"
 
-std::unique_ptr<webrtc::VideoEncoderFactory> CreateCustomizedVideoEncoderFactory(Args args) {
-    return std::make_unique<CustomizedVideoEncoderFactory>(args);
+std::unique_ptr<webrtc::VideoEncoderFactory>
+CreateCustomizedVideoEncoderFactory(Args args, std::shared_ptr<VideoCapturer> video_capturer) {
+    return std::make_unique<CustomizedVideoEncoderFactory>(args, video_capturer);
+}
+
+CustomizedVideoEncoderFactory::CustomizedVideoEncoderFactory(
+    Args args, std::shared_ptr<VideoCapturer> video_capturer)
+    : args_(args),
+      video_capturer_(video_capturer) {
+    if (args_.shared_encoder && !IsPassthrough()) {
+        // created up front, so it can run for the recorder before any peer is connected.
+        auto format = CreateH264Format(webrtc::H264Profile::kProfileConstrainedBaseline,
+                                       webrtc::H264Level::kLevel4, "1");
+        h264_encoder_hub_ =
+            VideoEncoderHub::Create([this, format]() { return CreateH264Encoder(format); });
+    }
+}
+
+std::shared_ptr<VideoEncoderHub> CustomizedVideoEncoderFactory::EncoderHub() const {
+    return h264_encoder_hub_;
 }
 
 std::vector<webrtc::SdpVideoFormat> CustomizedVideoEncoderFactory::GetSupportedFormats() const {
     std::vector<webrtc::SdpVideoFormat> supported_codecs;
 
-    if (args_.hw_accel) {
+    if (IsPassthrough()) {
+        // camera h264, the packets are too large for the single nal unit mode.
+        supported_codecs.push_back(
+            CreateH264Format(webrtc::H264Profile::kProfileHigh, webrtc::H264Level::kLevel4, "1"));
+        supported_codecs.push_back(CreateH264Format(
+            webrtc::H264Profile::kProfileConstrainedBaseline, webrtc::H264Level::kLevel4, "1"));
+        supported_codecs.push_back(
+            CreateH264Format(webrtc::H264Profile::kProfileBaseline, webrtc::H264Level::kLevel4, "1"));
+    } else if (args_.hw_accel) {
         // hw h264
         supported_codecs.push_back(CreateH264Format(webrtc::H264Profile::kProfileConstrainedBaseline,
                                                 webrtc::H264Level::kLevel4, "1"));
@@ -48,11 +76,13 @@ std::vector<webrtc::SdpVideoFormat> CustomizedVideoEncoderFactory::GetSupportedF
 std::unique_ptr<webrtc::VideoEncoder>
 CustomizedVideoEncoderFactory::CreateVideoEncoder(const webrtc::SdpVideoFormat &format) {
     if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName)) {
-        if (args_.hw_accel) {
-            return V4l2H264Encoder::Create();
-        } else {
-            return webrtc::H264Encoder::Create(cricket::VideoCodec(format));
+        if (IsPassthrough()) {
+            return RawH264Encoder::Create(video_capturer_);
         }
+        if (h264_encoder_hub_ && IsSharable(format)) {
+            return SharedVideoEncoder::Create(h264_encoder_hub_);
+        }
+        return CreateH264Encoder(format);
     } else if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName)) {
         return webrtc::VP8Encoder::Create();
     } else if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName)) {
@@ -63,3 +93,25 @@ CustomizedVideoEncoderFactory::CreateVideoEncoder(const webrtc::SdpVideoFormat &
 
     return nullptr;
 }
+
+bool CustomizedVideoEncoderFactory::IsPassthrough() const {
+    return video_capturer_ && video_capturer_->format() == V4L2_PIX_FMT_H264;
+}
+
+bool CustomizedVideoEncoderFactory::IsSharable(const webrtc::SdpVideoFormat &format) const {
+    // the hw encoder always outputs non-interleaved packets, but the sw one follows the format.
+    if (args_.hw_accel) {
+        return true;
+    }
+    auto it = format.parameters.find(cricket::kH264FmtpPacketizationMode);
+    return it != format.parameters.end() && it->second == "1";
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+CustomizedVideoEncoderFactory::CreateH264Encoder(const webrtc::SdpVideoFormat &format) {
+    if (args_.hw_accel) {
+        return V4l2H264Encoder::Create();
+    } else {
+        return webrtc::H264Encoder::Create(cricket::VideoCodec(format));
+    }
+}
@@ -4,15 +4,20 @@
 #include <api/video_codecs/video_encoder_factory.h>
 
 #include "args.h"
+#include "capturer/video_capturer.h"
+#include "shared_video_encoder.h"
 
-std::unique_ptr<webrtc::VideoEncoderFactory> CreateCustomizedVideoEncoderFactory(Args args);
+std::unique_ptr<webrtc::VideoEncoderFactory>
+CreateCustomizedVideoEncoderFactory(Args args, std::shared_ptr<VideoCapturer> video_capturer);
 
 class CustomizedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
   public:
-    CustomizedVideoEncoderFactory(Args args)
-        : args_(args){};
+    CustomizedVideoEncoderFactory(Args args, std::shared_ptr<VideoCapturer> video_capturer);
     ~CustomizedVideoEncoderFactory() = default;
 
+    // the h264 encoder shared by the peers, nullptr if it's not enabled.
+    std::shared_ptr<VideoEncoderHub> EncoderHub() const;
+
     std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
 
     std::unique_ptr<webrtc::VideoEncoder>
@@ -20,6 +25,12 @@ class CustomizedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
 
   private:
     Args args_;
+    std::shared_ptr<VideoCapturer> video_capturer_;
+    std::shared_ptr<VideoEncoderHub> h264_encoder_hub_;
+
+    bool IsPassthrough() const;
+    bool IsSharable(const webrtc::SdpVideoFormat &format) const;
+    std::unique_ptr<webrtc::VideoEncoder> CreateH264Encoder(const webrtc::SdpVideoFormat &format);
 };
 
 #endif // CUSTOMIZED_VIDEO_ENCODER_FACTORY_H_
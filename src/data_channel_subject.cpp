@@ -1,14 +1,87 @@
 #include "data_channel_subject.h"
 
+#include <algorithm>
+#include <fcntl.h>
 #include <iostream>
 #include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "common/logging.h"
 
-const int CHUNK_SIZE = 65536;
+// the default max message size of sctp (RFC 8841), if the remote doesn't tell.
+const size_t CHUNK_SIZE = 65536;
+// the larger messages would hold up the other channels on the association.
+const size_t MAX_CHUNK_SIZE = 256 * 1024;
+// the smaller ones would be mostly headers, and the sending would spin on them.
+const size_t MIN_CHUNK_SIZE = 1024;
+// the payload size is the chunk size less the type and sequence, which mustn't wrap around.
+static_assert(MIN_CHUNK_SIZE > sizeof(CommandType) + sizeof(uint32_t) &&
+                  CHUNK_SIZE >= MIN_CHUNK_SIZE && CHUNK_SIZE <= MAX_CHUNK_SIZE,
+              "the chunk sizes must leave room for the payload");
+// the sending stops above the high watermark and resumes once drained below the low one.
+const int64_t HIGH_WATERMARK = 1024 * 1024;
+const int64_t LOW_WATERMARK = 256 * 1024;
+
+/* Maps the range of the file, or the rest of it if the length is 0. The mapping has to start
+ * on a page boundary, the returned pointer is at the offset. */
+static std::shared_ptr<uint8_t> MapFile(const std::string &path, size_t offset, size_t length,
+                                        size_t &file_size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ERROR_PRINT("Unable to open file: %s", path.c_str());
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ERROR_PRINT("Unable to stat file: %s", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    file_size = st.st_size;
+    if (offset > file_size || length > file_size - offset) {
+        ERROR_PRINT("The range %zu+%zu is out of the file: %s (%zu bytes)", offset, length,
+                    path.c_str(), file_size);
+        close(fd);
+        return nullptr;
+    }
+    if (length == 0) {
+        length = file_size - offset;
+    }
+
+    // the chunks are copied straight from the page cache into the messages.
+    size_t page_offset = offset & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+    size_t map_size = length + (offset - page_offset);
+    void *mapped = length > 0
+                       ? mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, page_offset)
+                       : nullptr;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        ERROR_PRINT("Unable to map file: %s, %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    if (!mapped) {
+        // an empty range, which has nothing to read.
+        return std::shared_ptr<uint8_t>(new uint8_t[1], std::default_delete<uint8_t[]>());
+    }
+
+    madvise(mapped, map_size, MADV_SEQUENTIAL);
+    uint8_t *base = static_cast<uint8_t *>(mapped);
+    return std::shared_ptr<uint8_t>(base + (offset - page_offset),
+                                    [base, map_size](uint8_t *) { munmap(base, map_size); });
+}
+
+DataChannelSubject::DataChannelSubject()
+    : is_pumping_(false),
+      buffered_amount_(0),
+      chunk_size_(CHUNK_SIZE),
+      last_sent_type_(CommandType::UNKNOWN) {}
 
 DataChannelSubject::~DataChannelSubject() {
     UnSubscribe();
+    ClearQueues();
     data_channel_->UnregisterObserver();
     data_channel_->Close();
 }
@@ -16,6 +89,13 @@ DataChannelSubject::~DataChannelSubject() {
 void DataChannelSubject::OnStateChange() {
     webrtc::DataChannelInterface::DataState state = data_channel_->state();
     DEBUG_PRINT("OnStateChange => %s", webrtc::DataChannelInterface::DataStateString(state));
+
+    if (state == webrtc::DataChannelInterface::kOpen) {
+        // the messages queued before the channel was open.
+        Pump();
+    } else if (state != webrtc::DataChannelInterface::kConnecting) {
+        ClearQueues();
+    }
 }
 
 void DataChannelSubject::OnMessage(const webrtc::DataBuffer &buffer) {
@@ -26,6 +106,13 @@ void DataChannelSubject::OnMessage(const webrtc::DataBuffer &buffer) {
     Next(message);
 }
 
+void DataChannelSubject::OnBufferedAmountChange(uint64_t sent_data_size) {
+    int64_t amount = buffered_amount_.fetch_sub(sent_data_size) - (int64_t)sent_data_size;
+    if (amount <= LOW_WATERMARK) {
+        Pump();
+    }
+}
+
 void DataChannelSubject::Next(std::string message) {
     try {
         json jsonObj = json::parse(message.c_str());
@@ -71,81 +158,250 @@ void DataChannelSubject::UnSubscribe() {
 }
 
 void DataChannelSubject::Send(CommandType type, const uint8_t *data, size_t size) {
-    int bytes_read = 0;
-    const size_t header_size = sizeof(CommandType);
+    auto payload = std::make_shared<std::vector<uint8_t>>(data, data + size);
+    SendTask task;
+    task.type = type;
+    task.size = size;
+    task.read = [payload](uint8_t *dst, size_t offset, size_t length) {
+        memcpy(dst, payload->data() + offset, length);
+        return true;
+    };
+    Enqueue(std::move(task));
+}
+
+void DataChannelSubject::Send(Buffer image) {
+    auto payload = std::make_shared<Buffer>(std::move(image));
+    SendTask task;
+    task.type = CommandType::SNAPSHOT;
+    task.size = payload->length;
+    task.has_envelope = true;
+    task.read = [payload](uint8_t *dst, size_t offset, size_t length) {
+        memcpy(dst, payload->start.get() + offset, length);
+        return true;
+    };
+    DEBUG_PRINT("Image queued: %lu bytes", payload->length);
+    Enqueue(std::move(task));
+}
+
+bool DataChannelSubject::SendFile(const std::string &path) {
+    size_t file_size = 0;
+    auto file = MapFile(path, 0, 0, file_size);
+    if (!file) {
+        return false;
+    }
+
+    SendTask task;
+    task.type = CommandType::RECORD;
+    task.size = file_size;
+    task.has_envelope = true;
+    task.read = [file](uint8_t *dst, size_t offset, size_t length) {
+        memcpy(dst, file.get() + offset, length);
+        return true;
+    };
+    DEBUG_PRINT("File queued: %s (%zu bytes)", path.c_str(), task.size);
+    Enqueue(std::move(task));
+    return true;
+}
+
+bool DataChannelSubject::SendFile(const std::string &path, size_t offset, size_t length) {
+    size_t file_size = 0;
+    auto file = MapFile(path, offset, length, file_size);
+    if (!file) {
+        return false;
+    }
+
+    SendTask task;
+    task.type = CommandType::RECORD;
+    task.size = length == 0 ? file_size - offset : length;
+    task.has_envelope = true;
+    task.has_sequence = true;
+    // chunk_size_ is kept in [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE] by SetMaxMessageSize().
+    task.chunk_size = chunk_size_.load() - (sizeof(CommandType) + sizeof(uint32_t));
+    task.read = [file](uint8_t *dst, size_t offset, size_t length) {
+        memcpy(dst, file.get() + offset, length);
+        return true;
+    };
 
-    std::vector<char> data_with_header(CHUNK_SIZE);
+    json header;
+    header["path"] = path;
+    header["size"] = file_size;
+    header["offset"] = offset;
+    header["length"] = task.size;
+    header["chunk_size"] = task.chunk_size;
+    task.header = header.dump();
 
-    if (size == 0) {
-        std::memcpy(data_with_header.data(), &type, header_size);
-        Send((uint8_t *)data_with_header.data(), header_size);
+    DEBUG_PRINT("File queued: %s (%zu bytes from %zu)", path.c_str(), task.size, offset);
+    Enqueue(std::move(task));
+    return true;
+}
+
+void DataChannelSubject::Cancel(CommandType type) {
+    std::lock_guard<std::mutex> lock(send_mtx_);
+    auto it = send_queues_.find(type);
+    if (it == send_queues_.end()) {
         return;
     }
 
-    while (bytes_read < size) {
-        if (data_channel_->buffered_amount() + CHUNK_SIZE > data_channel_->MaxSendQueueSize()) {
-            sleep(1);
-            DEBUG_PRINT("Sleeping for 1 second due to MaxSendQueueSize reached.");
-            continue;
-        }
-        int read_size = std::min(CHUNK_SIZE - header_size, size - bytes_read);
+    auto &queue = it->second;
+    if (queue.front().is_started) {
+        // the client is waiting for its closing message.
+        auto &task = queue.front();
+        task.size = task.offset;
+        task.is_cancelled = true;
+        queue.erase(queue.begin() + 1, queue.end());
+    } else {
+        send_queues_.erase(it);
+    }
+    DEBUG_PRINT("The queued messages of type %d are cancelled.", static_cast<int>(type));
+}
 
-        std::memcpy(data_with_header.data(), &type, header_size);
-        std::memcpy(data_with_header.data() + header_size, data + bytes_read, read_size);
+void DataChannelSubject::SetMaxMessageSize(size_t size) {
+    // 0 is unlimited by RFC 8841.
+    size_t chunk_size =
+        size == 0 ? MAX_CHUNK_SIZE : std::clamp(size, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    chunk_size_.store(chunk_size);
+    DEBUG_PRINT("Data channel chunk size: %zu bytes", chunk_size);
+}
 
-        Send((uint8_t *)data_with_header.data(), read_size + header_size);
-        bytes_read += read_size;
+void DataChannelSubject::Enqueue(SendTask task) {
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        send_queues_[task.type].push_back(std::move(task));
     }
+    Pump();
 }
 
-void DataChannelSubject::Send(const uint8_t *data, size_t size) {
+void DataChannelSubject::Pump() {
     if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
+        // it's started by OnStateChange once the channel is open.
         return;
     }
-    rtc::CopyOnWriteBuffer buffer(data, size);
-    webrtc::DataBuffer data_buffer(buffer, true);
-    data_channel_->Send(data_buffer);
+
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        if (is_pumping_) {
+            // the running pump sees the new state on its next round.
+            return;
+        }
+        is_pumping_ = true;
+    }
+
+    rtc::CopyOnWriteBuffer message;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(send_mtx_);
+            if (buffered_amount_.load() >= HIGH_WATERMARK || !NextMessage(message)) {
+                // it's resumed by OnBufferedAmountChange once the queue drains.
+                is_pumping_ = false;
+                return;
+            }
+        }
+
+        // never hold the lock while calling into webrtc, which may call back.
+        if (!Send(std::move(message))) {
+            ERROR_PRINT("Failed to send on the data channel, drop the queued messages.");
+            ClearQueues();
+            std::lock_guard<std::mutex> lock(send_mtx_);
+            is_pumping_ = false;
+            return;
+        }
+    }
 }
 
-void DataChannelSubject::Send(Buffer image) {
-    const int file_size = image.length;
-    auto type = CommandType::SNAPSHOT;
-    std::string size_str = std::to_string(file_size);
-    Send(type, (uint8_t *)size_str.c_str(), size_str.length());
-    Send(type, (uint8_t *)image.start.get(), file_size);
-    Send(type, nullptr, 0);
-
-    DEBUG_PRINT("Image sent: %d bytes", file_size);
-}
-
-void DataChannelSubject::Send(std::ifstream &file) {
-    std::vector<char> buffer(CHUNK_SIZE);
-    int bytes_read = 0;
-    int count = 0;
-    const int header_size = sizeof(CommandType);
-    auto type = CommandType::RECORD;
-
-    int file_size = file.tellg();
-    std::string size_str = std::to_string(file_size);
-    file.seekg(0, std::ios::beg);
-
-    Send(type, (uint8_t *)size_str.c_str(), size_str.length());
-
-    while (bytes_read < file_size) {
-        if (data_channel_->buffered_amount() + CHUNK_SIZE > data_channel_->MaxSendQueueSize()) {
-            sleep(1);
-            DEBUG_PRINT("Sleeping for 1 second due to MaxSendQueueSize reached.");
-            continue;
+bool DataChannelSubject::NextMessage(rtc::CopyOnWriteBuffer &message) {
+    if (send_queues_.empty()) {
+        return false;
+    }
+
+    // take turns between the types, so a long download doesn't hold up the other messages.
+    auto it = send_queues_.upper_bound(last_sent_type_);
+    if (it == send_queues_.end()) {
+        it = send_queues_.begin();
+    }
+    last_sent_type_ = it->first;
+    auto &queue = it->second;
+    auto &task = queue.front();
+
+    const size_t header_size = sizeof(CommandType) + (task.has_sequence ? sizeof(uint32_t) : 0);
+    bool is_done = false;
+    if (task.has_envelope && !task.is_started) {
+        auto header = task.has_sequence ? task.header : std::to_string(task.size);
+        message.SetData(reinterpret_cast<const uint8_t *>(&task.type), sizeof(CommandType));
+        message.AppendData(header.data(), header.length());
+        task.is_started = true;
+    } else if (task.offset < task.size) {
+        // the payload is read right into the message, which webrtc takes without a copy.
+        size_t chunk_size =
+            task.has_sequence ? task.chunk_size : chunk_size_.load() - header_size;
+        size_t length = std::min(chunk_size, task.size - task.offset);
+        message = rtc::CopyOnWriteBuffer(header_size + length);
+        uint8_t *data = message.MutableData();
+        std::memcpy(data, &task.type, sizeof(CommandType));
+        if (task.has_sequence) {
+            // big endian, as the DataView of the browsers reads by default.
+            for (int i = 0; i < 4; i++) {
+                data[sizeof(CommandType) + i] = task.sequence >> (24 - i * 8);
+            }
+        }
+        if (task.read(data + header_size, task.offset, length)) {
+            if (task.has_sequence) {
+                task.crc = Utils::Crc32(task.crc, data + header_size, length);
+                task.sequence++;
+            }
+            task.offset += length;
+            is_done = !task.has_envelope && task.offset >= task.size;
+        } else {
+            // close it early, the client sees fewer bytes than announced.
+            ERROR_PRINT("Failed to read the payload at %zu bytes.", task.offset);
+            task.size = task.offset;
+            task.is_cancelled = true;
+            EndMessage(task, message);
+            is_done = true;
+        }
+    } else {
+        EndMessage(task, message);
+        is_done = true;
+    }
+
+    if (is_done) {
+        queue.pop_front();
+        if (queue.empty()) {
+            send_queues_.erase(it);
         }
-        int read_size = std::min(CHUNK_SIZE - header_size, file_size - bytes_read);
-        std::memcpy(buffer.data(), &type, header_size);
-        file.read(buffer.data() + header_size, read_size);
+    }
+    return true;
+}
 
-        Send((uint8_t *)buffer.data(), read_size + header_size);
-        bytes_read += read_size;
+void DataChannelSubject::EndMessage(SendTask &task, rtc::CopyOnWriteBuffer &message) {
+    message.SetData(reinterpret_cast<const uint8_t *>(&task.type), sizeof(CommandType));
+    if (task.has_sequence) {
+        // the client checks what it has put together, and resumes from the count if cut short.
+        json trailer;
+        trailer["chunks"] = task.sequence;
+        trailer["crc32"] = task.crc;
+        trailer["cancelled"] = task.is_cancelled;
+        auto trailer_str = trailer.dump();
+        message.AppendData(trailer_str.data(), trailer_str.length());
     }
+}
+
+void DataChannelSubject::ClearQueues() {
+    std::lock_guard<std::mutex> lock(send_mtx_);
+    send_queues_.clear();
+}
 
-    Send(type, nullptr, 0);
+bool DataChannelSubject::Send(rtc::CopyOnWriteBuffer message) {
+    if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
+        return false;
+    }
+    size_t size = message.size();
+    webrtc::DataBuffer data_buffer(message, true);
+    buffered_amount_ += size;
+    if (!data_channel_->Send(data_buffer)) {
+        buffered_amount_ -= size;
+        return false;
+    }
+    return true;
 }
 
 void DataChannelSubject::SetDataChannel(
@@ -3,8 +3,12 @@
 
 #include "common/interface/subject.h"
 
+#include <atomic>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <vector>
 
 #include <api/data_channel_interface.h>
@@ -19,13 +23,19 @@ enum class CommandType : uint8_t {
     SNAPSHOT,
     METADATA,
     RECORD,
-    UNKNOWN
+    UNKNOWN,
+    // appended, so the values the clients already send keep their meaning.
+    TRIGGER,
+    MOTION
 };
 
 enum class MetadataCommand : uint8_t {
     LATEST,
     OLDER,
-    SPECIFIC_TIME
+    SPECIFIC_TIME,
+    // the latency of the pipeline stages and the buffer pool usage, it doesn't need the
+    // recording.
+    STATS
 };
 
 struct RtcMessage {
@@ -43,40 +53,39 @@ struct RtcMessage {
     }
 };
 
-struct MetaMessage {
-    std::string path;
-    int duration;
-    std::string image;
-
-    MetaMessage(std::string file_path)
-        : path(file_path),
-          duration(Utils::GetVideoDuration(file_path)) {
-      
-      int dot_pos = file_path.rfind('.');
-      auto thumbnail_path = file_path.substr(0, dot_pos) + ".jpg";
-      auto binary_data = Utils::ReadFileInBinary(thumbnail_path);
-      auto base64_data = Utils::ToBase64(binary_data);
-      image = "data:image/jpeg;base64," + base64_data;
-    }
+/* The payload queued to be sent in chunks. An enveloped one is led by its size and closed by
+ * an empty message, as the clients expect for the files and images. A sequenced one is led by
+ * its json `header` instead, each chunk carries its number and the closing message the count
+ * and the crc32 of the payload. */
+struct SendTask {
+    using ReadFunc = std::function<bool(uint8_t *dst, size_t offset, size_t length)>;
 
-    std::string ToString() const {
-        json j;
-        j["path"] = path;
-        j["duration"] = duration;
-        j["image"] = image;
-        return j.dump();
-    }
+    CommandType type;
+    size_t size;
+    ReadFunc read;
+    bool has_envelope = false;
+    bool is_started = false;
+    size_t offset = 0;
+
+    bool has_sequence = false;
+    std::string header;
+    // the payload of each chunk, fixed when queued, so the client can resume from a number.
+    size_t chunk_size = 0;
+    uint32_t sequence = 0;
+    uint32_t crc = 0;
+    bool is_cancelled = false;
 };
 
 class DataChannelSubject : public webrtc::DataChannelObserver,
                            public Subject<std::string> {
   public:
-    DataChannelSubject() = default;
+    DataChannelSubject();
     ~DataChannelSubject();
 
     // webrtc::DataChannelObserver
     void OnStateChange() override;
     void OnMessage(const webrtc::DataBuffer &buffer) override;
+    void OnBufferedAmountChange(uint64_t sent_data_size) override;
 
     // Subject
     void Next(std::string message) override;
@@ -84,16 +93,36 @@ class DataChannelSubject : public webrtc::DataChannelObserver,
     std::shared_ptr<Observable<std::string>> AsObservable(CommandType type);
     void UnSubscribe() override;
 
+    // all the sends are queued and return at once, the messages of a type keep their order.
     void Send(CommandType type, const uint8_t *data, size_t size);
     void Send(Buffer image);
-    void Send(std::ifstream &file);
+    bool SendFile(const std::string &path);
+    // sends `length` bytes from `offset` with the numbered chunks, 0 is up to the end.
+    bool SendFile(const std::string &path, size_t offset, size_t length);
+    // the started transfer is closed early and the queued ones of the type are dropped.
+    void Cancel(CommandType type);
+    // the largest message the remote accepts, from its sdp. 0 is unlimited.
+    void SetMaxMessageSize(size_t size);
     void SetDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel);
 
   private:
     rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
     std::map<CommandType, std::vector<std::shared_ptr<Observable<std::string>>>> observers_map_;
-  
-    void Send(const uint8_t *data, size_t size);
+
+    std::mutex send_mtx_;
+    bool is_pumping_;
+    // counted here, so it's known without a blocking call into the webrtc threads.
+    std::atomic<int64_t> buffered_amount_;
+    std::atomic<size_t> chunk_size_;
+    CommandType last_sent_type_;
+    std::map<CommandType, std::deque<SendTask>> send_queues_;
+
+    void Enqueue(SendTask task);
+    void Pump();
+    bool NextMessage(rtc::CopyOnWriteBuffer &message);
+    void ClearQueues();
+    void EndMessage(SendTask &task, rtc::CopyOnWriteBuffer &message);
+    bool Send(rtc::CopyOnWriteBuffer message);
 };
 
 #endif
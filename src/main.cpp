@@ -1,11 +1,15 @@
 #include <iostream>
 
 #include "args.h"
+#include "common/event_loop.h"
 #include "common/logging.h"
 #include "common/utils.h"
 #include "conductor.h"
+#include "motion/motion_detector.h"
 #include "parser.h"
 #include "recorder/recorder_manager.h"
+#include "recorder/recording_catalog.h"
+#include "recorder/retention_engine.h"
 #include "signaling/signaling_service.h"
 #if USE_MQTT_SIGNALING
 #include "signaling/mqtt_service.h"
@@ -17,17 +21,34 @@ int main(int argc, char *argv[]) {
     Args args;
     Parser::ParseArgs(argc, argv, args);
 
+    if (args.event_loop_core >= 0) {
+        EventLoop::Shared()->SetAffinity(args.event_loop_core);
+    }
+
     std::shared_ptr<Conductor> conductor = Conductor::Create(args);
-    std::unique_ptr<RecorderManager> recorder_mgr;
+    std::shared_ptr<RecorderManager> recorder_mgr;
+    std::unique_ptr<RetentionEngine> retention_engine;
 
     if (Utils::CreateFolder(args.record_path)) {
+        auto catalog = RecordingCatalog::Create(args.record_path);
+        conductor->SetRecordingCatalog(catalog);
+        retention_engine = RetentionEngine::Create(args, catalog);
         recorder_mgr = RecorderManager::Create(conductor->VideoSource(), conductor->AudioSource(),
-                                               args.record_path);
+                                               args.record_path, catalog,
+                                               conductor->StartSharedEncoder());
+        conductor->SetRecorderManager(recorder_mgr);
         DEBUG_PRINT("Recorder is running!");
     } else {
         DEBUG_PRINT("Recorder is not started!");
     }
 
+    std::shared_ptr<MotionDetector> motion_detector;
+    if (args.motion_detection) {
+        motion_detector = MotionDetector::Create(args, conductor->VideoSource());
+        conductor->SetMotionDetector(motion_detector);
+        DEBUG_PRINT("Motion detection is running!");
+    }
+
     auto signaling_service = ([args, conductor]() -> std::shared_ptr<SignalingService> {
 #if USE_MQTT_SIGNALING
         return MqttService::Create(args, conductor);
@@ -0,0 +1,234 @@
+#include "motion/motion_detector.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <nlohmann/json.hpp>
+#include <third_party/libyuv/include/libyuv.h>
+
+#include "common/logging.h"
+
+using json = nlohmann::json;
+
+static const int kWaitTimeoutMs = 500;
+// the motion has stopped after this long without any.
+static const int kMotionHoldMs = 2000;
+// keeps the recorder triggered while the motion goes on.
+static const int kRepeatEventMs = 1000;
+// most of the frame changes at once when the exposure or the light does, not the scene.
+static const float kGlobalChangeRatio = 0.7f;
+
+static int CountChangedPixels(const uint8_t *a, const uint8_t *b, int length,
+                              uint8_t threshold) {
+    int count = 0;
+    int i = 0;
+#if defined(__ARM_NEON)
+    const uint8x16_t thresholds = vdupq_n_u8(threshold);
+    uint16x8_t sums = vdupq_n_u16(0);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        // the changed lanes are 0xff, shift them down to 1 and accumulate.
+        uint8x16_t changed = vshrq_n_u8(vcgtq_u8(diff, thresholds), 7);
+        sums = vpadalq_u8(sums, changed);
+    }
+    uint64x2_t total = vpaddlq_u32(vpaddlq_u16(sums));
+    count = vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#endif
+    for (; i < length; i++) {
+        count += std::abs(a[i] - b[i]) > threshold;
+    }
+    return count;
+}
+
+std::string MotionEvent::ToString() const {
+    json j;
+    j["moving"] = is_moving;
+    j["score"] = score;
+    j["zone"] = zone;
+    j["timestamp"] = timestamp_us;
+    return j.dump();
+}
+
+std::vector<MotionZone> MotionDetector::ParseZones(const std::string &zones) {
+    std::vector<MotionZone> result;
+    std::stringstream ss(zones);
+    std::string zone;
+    while (std::getline(ss, zone, ';')) {
+        MotionZone z;
+        if (sscanf(zone.c_str(), "%f,%f,%f,%f", &z.x, &z.y, &z.width, &z.height) != 4 ||
+            z.x < 0 || z.y < 0 || z.width <= 0 || z.height <= 0 || z.x + z.width > 1.0f ||
+            z.y + z.height > 1.0f) {
+            ERROR_PRINT("Ignore the invalid motion zone: %s", zone.c_str());
+            continue;
+        }
+        result.push_back(z);
+    }
+    if (result.empty()) {
+        result.push_back({0.0f, 0.0f, 1.0f, 1.0f});
+    }
+    return result;
+}
+
+std::shared_ptr<MotionDetector> MotionDetector::Create(Args args,
+                                                       std::shared_ptr<VideoCapturer> capturer) {
+    auto ptr = std::make_shared<MotionDetector>(args);
+    ptr->SubscribeFrameBuffer(capturer);
+    ptr->worker_.reset(new Worker("MotionDetector", [ptr = ptr.get()]() {
+        ptr->Detect();
+    }));
+    ptr->worker_->Run();
+    return ptr;
+}
+
+MotionDetector::MotionDetector(Args args)
+    : sample_interval_ms_(1000 / std::max(1, std::min(args.motion_fps, args.fps))),
+      has_sample_(false),
+      sample_timestamp_us_(0),
+      sample_(kProxyWidth * kProxyHeight),
+      current_(kProxyWidth * kProxyHeight),
+      previous_(kProxyWidth * kProxyHeight),
+      has_previous_(false),
+      is_moving_(false) {
+    // a higher sensitivity catches the smaller changes over the smaller areas.
+    int sensitivity = std::clamp(args.motion_sensitivity, 1, 100);
+    pixel_threshold_ = 8 + (100 - sensitivity) * 40 / 100;
+    float area_ratio = 0.002f + (100 - sensitivity) * 0.001f;
+
+    for (const auto &zone : ParseZones(args.motion_zones)) {
+        ZoneRect rect;
+        rect.x = zone.x * kProxyWidth;
+        rect.y = zone.y * kProxyHeight;
+        rect.width = std::max(1, (int)(zone.width * kProxyWidth));
+        rect.height = std::max(1, (int)(zone.height * kProxyHeight));
+        rect.width = std::min(rect.width, kProxyWidth - rect.x);
+        rect.height = std::min(rect.height, kProxyHeight - rect.y);
+        rect.area_threshold = std::max(1, (int)(rect.width * rect.height * area_ratio));
+        zones_.push_back(rect);
+    }
+
+    DEBUG_PRINT("Motion detection at %d ms intervals in %zu zones, pixel threshold: %d",
+                sample_interval_ms_, zones_.size(), pixel_threshold_);
+}
+
+MotionDetector::~MotionDetector() {
+    if (frame_buffer_observer_) {
+        frame_buffer_observer_->UnSubscribe();
+    }
+    worker_.reset();
+    UnSubscribe();
+}
+
+void MotionDetector::SubscribeFrameBuffer(std::shared_ptr<VideoCapturer> capturer) {
+    frame_buffer_observer_ = capturer->AsFrameBufferObservable();
+    frame_buffer_observer_->Subscribe([this](rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
+        OnFrameBuffer(frame_buffer);
+    });
+}
+
+void MotionDetector::OnFrameBuffer(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_sample_time_ < std::chrono::milliseconds(sample_interval_ms_)) {
+        return;
+    }
+
+    const uint8_t *src_y;
+    int src_stride_y;
+    rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer;
+    if (frame_buffer->format() == V4L2_PIX_FMT_YUV420) {
+        src_y = static_cast<const uint8_t *>(frame_buffer->Data());
+        src_stride_y = frame_buffer->width();
+    } else if (frame_buffer->format() == V4L2_PIX_FMT_MJPEG) {
+        // the conversion is kept in the frame buffer, the track reuses it.
+        i420_buffer = frame_buffer->ToI420();
+        src_y = i420_buffer->DataY();
+        src_stride_y = i420_buffer->StrideY();
+    } else {
+        return;
+    }
+    last_sample_time_ = now;
+
+    // the downscaled copy is made here, so the capture buffer is never held by the worker.
+    // bilinear only reads the rows around the sampled ones, unlike box filtering.
+    std::lock_guard<std::mutex> lock(mtx_);
+    libyuv::ScalePlane(src_y, src_stride_y, frame_buffer->width(), frame_buffer->height(),
+                       sample_.data(), kProxyWidth, kProxyWidth, kProxyHeight,
+                       libyuv::kFilterBilinear);
+    auto timestamp = frame_buffer->timestamp();
+    sample_timestamp_us_ = (int64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+    has_sample_ = true;
+    cond_.notify_one();
+}
+
+void MotionDetector::Detect() {
+    int64_t timestamp_us;
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (!cond_.wait_for(lock, std::chrono::milliseconds(kWaitTimeoutMs),
+                            [this]() { return has_sample_; })) {
+            return;
+        }
+        std::swap(sample_, current_);
+        timestamp_us = sample_timestamp_us_;
+        has_sample_ = false;
+    }
+
+    if (!has_previous_) {
+        std::swap(previous_, current_);
+        has_previous_ = true;
+        return;
+    }
+
+    int total_changed = CountChangedPixels(previous_.data(), current_.data(),
+                                           kProxyWidth * kProxyHeight, pixel_threshold_);
+    if (total_changed > kProxyWidth * kProxyHeight * kGlobalChangeRatio) {
+        std::swap(previous_, current_);
+        return;
+    }
+
+    float max_score = 0.0f;
+    int max_zone = -1;
+    for (int i = 0; i < zones_.size(); i++) {
+        const auto &zone = zones_[i];
+        int changed = 0;
+        for (int row = zone.y; row < zone.y + zone.height; row++) {
+            int offset = row * kProxyWidth + zone.x;
+            changed += CountChangedPixels(previous_.data() + offset, current_.data() + offset,
+                                          zone.width, pixel_threshold_);
+        }
+        if (changed >= zone.area_threshold) {
+            float score = (float)changed / (zone.width * zone.height);
+            if (score > max_score) {
+                max_score = score;
+                max_zone = i;
+            }
+        }
+    }
+
+    std::swap(previous_, current_);
+
+    auto now = std::chrono::steady_clock::now();
+    if (max_zone >= 0) {
+        last_motion_time_ = now;
+        if (!is_moving_ || now - last_event_time_ >= std::chrono::milliseconds(kRepeatEventMs)) {
+            Emit(true, max_score, max_zone, timestamp_us);
+        }
+    } else if (is_moving_ &&
+               now - last_motion_time_ >= std::chrono::milliseconds(kMotionHoldMs)) {
+        Emit(false, 0.0f, -1, timestamp_us);
+    }
+}
+
+void MotionDetector::Emit(bool is_moving, float score, int zone, int64_t timestamp_us) {
+    if (is_moving != is_moving_) {
+        DEBUG_PRINT("Motion %s, score: %.3f, zone: %d", is_moving ? "started" : "stopped", score,
+                    zone);
+    }
+    is_moving_ = is_moving;
+    last_event_time_ = std::chrono::steady_clock::now();
+    Next({is_moving, score, zone, timestamp_us});
+}
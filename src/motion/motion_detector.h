@@ -0,0 +1,86 @@
+#ifndef MOTION_DETECTOR_H_
+#define MOTION_DETECTOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "capturer/video_capturer.h"
+#include "common/interface/subject.h"
+#include "common/worker.h"
+
+// a rectangle in the fractions of the frame, e.g. `0,0,0.5,1` is the left half.
+struct MotionZone {
+    float x;
+    float y;
+    float width;
+    float height;
+};
+
+struct MotionEvent {
+    bool is_moving;
+    // the changed fraction of the most active zone.
+    float score;
+    int zone;
+    int64_t timestamp_us;
+
+    std::string ToString() const;
+};
+
+/* Compares the luma of the sampled frames on a small proxy, so it costs little more than
+ * the scaling even on a Pi Zero. An event is emitted when the motion starts, repeated while
+ * it goes on, and once more when it has stopped. */
+class MotionDetector : public Subject<MotionEvent> {
+  public:
+    static const int kProxyWidth = 160;
+    static const int kProxyHeight = 120;
+
+    static std::shared_ptr<MotionDetector> Create(Args args,
+                                                  std::shared_ptr<VideoCapturer> capturer);
+    // parses `x,y,w,h;x,y,w,h`, the whole frame is a single zone if it's empty.
+    static std::vector<MotionZone> ParseZones(const std::string &zones);
+
+    MotionDetector(Args args);
+    ~MotionDetector();
+
+  private:
+    struct ZoneRect {
+        int x;
+        int y;
+        int width;
+        int height;
+        int area_threshold;
+    };
+
+    int sample_interval_ms_;
+    uint8_t pixel_threshold_;
+    std::vector<ZoneRect> zones_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool has_sample_;
+    int64_t sample_timestamp_us_;
+    std::chrono::steady_clock::time_point last_sample_time_;
+    std::vector<uint8_t> sample_;
+    std::vector<uint8_t> current_;
+    std::vector<uint8_t> previous_;
+    bool has_previous_;
+
+    bool is_moving_;
+    std::chrono::steady_clock::time_point last_motion_time_;
+    std::chrono::steady_clock::time_point last_event_time_;
+
+    std::shared_ptr<Observable<rtc::scoped_refptr<V4l2FrameBuffer>>> frame_buffer_observer_;
+    std::unique_ptr<Worker> worker_;
+
+    void SubscribeFrameBuffer(std::shared_ptr<VideoCapturer> capturer);
+    void OnFrameBuffer(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer);
+    void Detect();
+    void Emit(bool is_moving, float score, int zone, int64_t timestamp_us);
+};
+
+#endif // MOTION_DETECTOR_H_
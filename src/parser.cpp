@@ -16,6 +16,11 @@ void Parser::ParseArgs(int argc, char *argv[], Args &args) {
         "Set the rotation angle of the frame")(
         "peer_timeout", bpo::value<uint32_t>()->default_value(args.peer_timeout),
         "The connection timeout, in seconds, after receiving a remote offer")(
+        "capture_buffer_count", bpo::value<uint32_t>()->default_value(args.capture_buffer_count),
+        "The number of v4l2 capture buffers. The spare buffers are lent to the recorder and "
+        "tracks instead of copying every frame")(
+        "event_loop_core", bpo::value<int>()->default_value(args.event_loop_core),
+        "Pin the thread polling the camera and v4l2 codecs to the cpu core, -1 is not pinned")(
         "device", bpo::value<std::string>()->default_value(args.device),
         "Read the specific camera file via V4L2, default is /dev/video0")(
         "use_libcamera", bpo::bool_switch()->default_value(args.use_libcamera),
@@ -46,11 +51,57 @@ void Parser::ParseArgs(int argc, char *argv[], Args &args) {
             ("record_path", bpo::value<std::string>()->default_value(args.record_path),
              "The path to save the recording video files. The recorder will not start if it's "
              "empty")(
+                "record_fragment_ms",
+                bpo::value<int>()->default_value(args.record_fragment_ms),
+                "Record fragmented mp4, each fragment is cut at the first keyframe after this many "
+                "milliseconds. The recording survives a power cut up to the last fragment. 0 "
+                "records the plain mp4")(
+                "record_on_trigger", bpo::bool_switch()->default_value(args.record_on_trigger),
+                "Record only when triggered, e.g. by the `TRIGGER` data channel command, instead "
+                "of continuously. The packets before the trigger are kept in memory")(
+                "record_pre_event_sec", bpo::value<int>()->default_value(args.record_pre_event_sec),
+                "The seconds kept in memory and recorded before a trigger")(
+                "record_post_event_sec",
+                bpo::value<int>()->default_value(args.record_post_event_sec),
+                "The seconds to keep recording after the last trigger")(
+                "record_max_age_hours",
+                bpo::value<int>()->default_value(args.record_max_age_hours),
+                "Delete the recordings older than this many hours. 0 keeps them until the space "
+                "is needed")(
+                "record_max_mb", bpo::value<int>()->default_value(args.record_max_mb),
+                "Delete the oldest recordings once they take more than this many MB in total. 0 "
+                "is unlimited")(
+                "record_min_free_mb", bpo::value<int>()->default_value(args.record_min_free_mb),
+                "Delete the oldest recordings while the free space is below this many MB")(
+                "record_thin_after_hours",
+                bpo::value<int>()->default_value(args.record_thin_after_hours),
+                "Thin out the recordings older than this many hours. 0 never thins them")(
+                "record_thin_keep_one_of",
+                bpo::value<int>()->default_value(args.record_thin_keep_one_of),
+                "Keep one of this many one-minute recordings when thinning, the first of each "
+                "span")(
+                "record_thin_keyframes",
+                bpo::bool_switch()->default_value(args.record_thin_keyframes),
+                "Thin out the recordings by keeping only their keyframes, instead of dropping "
+                "the recordings")(
+                "motion_detection", bpo::bool_switch()->default_value(args.motion_detection),
+                "Detect the motion on the luma of the frames. The events are sent to the data "
+                "channels and trigger the recording")(
+                "motion_fps", bpo::value<int>()->default_value(args.motion_fps),
+                "The frames per second analyzed by the motion detection")(
+                "motion_sensitivity", bpo::value<int>()->default_value(args.motion_sensitivity),
+                "The motion sensitivity from 1 to 100, higher detects the smaller changes")(
+                "motion_zones", bpo::value<std::string>()->default_value(args.motion_zones),
+                "The areas watched for motion in the fractions of the frame, ex: "
+                "0,0,0.5,1;0.5,0.5,0.5,0.5. The whole frame is watched if it's empty")(
                 "hw_accel", bpo::bool_switch()->default_value(args.hw_accel),
                 "Share DMA buffers between decoder/scaler/encoder, which can decrease cpu usage")(
+                "shared_encoder", bpo::bool_switch()->default_value(args.shared_encoder),
+                "Encode the h264 video once and share the bitstream with all the connected peers "
+                "and the recorder, the bitrate follows the slowest peer")(
                 "v4l2_format", bpo::value<std::string>()->default_value(args.v4l2_format),
                 "Set v4l2 camera capture format to `i420`, `mjpeg`, `h264`. The `h264` can pass "
-                "packets into mp4 without encoding to reduce cpu usage."
+                "packets into mp4 and WebRTC without encoding to reduce cpu usage."
                 "Use `v4l2-ctl -d /dev/videoX --list-formats` can list available format");
 
     bpo::variables_map vm;
@@ -82,6 +133,14 @@ void Parser::ParseArgs(int argc, char *argv[], Args &args) {
         args.peer_timeout = vm["peer_timeout"].as<uint32_t>();
     }
 
+    if (vm.count("capture_buffer_count")) {
+        args.capture_buffer_count = vm["capture_buffer_count"].as<uint32_t>();
+    }
+
+    if (vm.count("event_loop_core")) {
+        args.event_loop_core = vm["event_loop_core"].as<int>();
+    }
+
     if (vm.count("device")) {
         args.device = vm["device"].as<std::string>();
     }
@@ -156,10 +215,70 @@ void Parser::ParseArgs(int argc, char *argv[], Args &args) {
         }
     }
 
+    if (vm.count("record_fragment_ms")) {
+        args.record_fragment_ms = vm["record_fragment_ms"].as<int>();
+    }
+
+    if (vm.count("record_on_trigger")) {
+        args.record_on_trigger = vm["record_on_trigger"].as<bool>();
+    }
+
+    if (vm.count("record_pre_event_sec")) {
+        args.record_pre_event_sec = vm["record_pre_event_sec"].as<int>();
+    }
+
+    if (vm.count("record_post_event_sec")) {
+        args.record_post_event_sec = vm["record_post_event_sec"].as<int>();
+    }
+
+    if (vm.count("record_max_age_hours")) {
+        args.record_max_age_hours = vm["record_max_age_hours"].as<int>();
+    }
+
+    if (vm.count("record_max_mb")) {
+        args.record_max_mb = vm["record_max_mb"].as<int>();
+    }
+
+    if (vm.count("record_min_free_mb")) {
+        args.record_min_free_mb = vm["record_min_free_mb"].as<int>();
+    }
+
+    if (vm.count("record_thin_after_hours")) {
+        args.record_thin_after_hours = vm["record_thin_after_hours"].as<int>();
+    }
+
+    if (vm.count("record_thin_keep_one_of")) {
+        args.record_thin_keep_one_of = vm["record_thin_keep_one_of"].as<int>();
+    }
+
+    if (vm.count("record_thin_keyframes")) {
+        args.record_thin_keyframes = vm["record_thin_keyframes"].as<bool>();
+    }
+
+    if (vm.count("motion_detection")) {
+        args.motion_detection = vm["motion_detection"].as<bool>();
+    }
+
+    if (vm.count("motion_fps")) {
+        args.motion_fps = vm["motion_fps"].as<int>();
+    }
+
+    if (vm.count("motion_sensitivity")) {
+        args.motion_sensitivity = vm["motion_sensitivity"].as<int>();
+    }
+
+    if (vm.count("motion_zones")) {
+        args.motion_zones = vm["motion_zones"].as<std::string>();
+    }
+
     if (vm.count("hw_accel")) {
         args.hw_accel = vm["hw_accel"].as<bool>();
     }
 
+    if (vm.count("shared_encoder")) {
+        args.shared_encoder = vm["shared_encoder"].as<bool>();
+    }
+
     if (!args.use_libcamera && vm.count("v4l2_format")) {
         args.v4l2_format = vm["v4l2_format"].as<std::string>();
 
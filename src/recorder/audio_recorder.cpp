@@ -62,7 +62,7 @@ void AudioRecorder::Encode() {
         return;
     }
 
-    frame->pts = frame_count * frame->nb_samples;
+    frame->pts = (int64_t)frame_count * frame->nb_samples;
     frame_count++;
 
     int ret = avcodec_send_frame(encoder, frame);
@@ -113,6 +113,9 @@ void AudioRecorder::OnBuffer(PaBuffer &buffer) {
     if (fifo_buffer.write(reinterpret_cast<void **>(converted_input_samples),
                             samples_per_channel) < samples_per_channel) {
         DEBUG_PRINT("Failed to write audio date into fifo buffer.");
+        DropFrame();
+    } else if (fifo_buffer.size() >= frame_size) {
+        NotifyBuffer();
     }
 
     if (converted_input_samples) {
@@ -130,6 +133,10 @@ bool AudioRecorder::ConsumeBuffer() {
     return true;
 }
 
+size_t AudioRecorder::queue_depth() {
+    return frame_size > 0 ? static_cast<size_t>(fifo_buffer.size() / frame_size) : 0;
+}
+
 void AudioRecorder::PreStart() {
     frame_count = 0;
     fifo_buffer.reset();
@@ -59,6 +59,7 @@ class AudioRecorder : public Recorder<PaBuffer> {
     ~AudioRecorder();
     void OnBuffer(PaBuffer &buffer) override;
     void PreStart() override;
+    size_t queue_depth() override;
 
   private:
     int sample_rate;
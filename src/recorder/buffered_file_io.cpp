@@ -0,0 +1,382 @@
+#include "recorder/buffered_file_io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/latency_stats.h"
+#include "common/logging.h"
+
+// the muxer's own buffer, it's only the staging of the copies into the large one.
+static const int kAvioBufferSize = 64 * 1024;
+static const size_t kPageSize = 4096;
+
+static int64_t AlignDown(int64_t value) { return value & ~(int64_t)(kPageSize - 1); }
+
+static int64_t AlignUp(int64_t value) { return AlignDown(value + kPageSize - 1); }
+
+static uint8_t *AllocateBuffer() {
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, kPageSize, BufferedFileIO::kBufferSize) != 0) {
+        ERROR_PRINT("Could not allocate the write buffer.");
+        return nullptr;
+    }
+    return static_cast<uint8_t *>(buffer);
+}
+
+std::atomic<uint64_t> BufferedFileIO::written_bytes_(0);
+
+AVIOContext *BufferedFileIO::Open(const std::string &path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ERROR_PRINT("Could not open %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    auto *io = new BufferedFileIO(path, fd);
+    if (!io->buffer_) {
+        delete io;
+        return nullptr;
+    }
+
+    auto *avio_buffer = static_cast<uint8_t *>(av_malloc(kAvioBufferSize));
+    if (avio_buffer) {
+        io->avio_ctx_ = avio_alloc_context(avio_buffer, kAvioBufferSize, 1, io, nullptr,
+                                           &BufferedFileIO::WritePacket,
+                                           &BufferedFileIO::SeekPacket);
+    }
+    if (!io->avio_ctx_) {
+        av_free(avio_buffer);
+        delete io;
+        return nullptr;
+    }
+    return io->avio_ctx_;
+}
+
+void BufferedFileIO::Close(AVIOContext **pb) {
+    if (!pb || !*pb) {
+        return;
+    }
+    avio_flush(*pb);
+    delete static_cast<BufferedFileIO *>((*pb)->opaque);
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
+
+bool BufferedFileIO::FlushFragment(AVIOContext *pb) {
+    if (!pb) {
+        return false;
+    }
+    avio_flush(pb);
+    auto *io = static_cast<BufferedFileIO *>(pb->opaque);
+    bool is_flushed = io->Flush();
+    // with io_uring, the sync is drained behind the writes just submitted.
+    if (io->unsynced_bytes_ > 0 && io->Sync()) {
+        io->unsynced_bytes_ = 0;
+        io->last_sync_time_ = std::chrono::steady_clock::now();
+    }
+    return is_flushed;
+}
+
+uint64_t BufferedFileIO::WrittenBytes() { return written_bytes_.load(); }
+
+BufferedFileIO::BufferedFileIO(const std::string &path, int fd)
+    : fd_(fd),
+      buffer_(AllocateBuffer()),
+      buffer_start_(0),
+      buffer_length_(0),
+      buffer_offset_(0),
+      file_size_(0),
+      unsynced_bytes_(0),
+      last_sync_time_(std::chrono::steady_clock::now()),
+      avio_ctx_(nullptr) {
+#if defined(USE_IO_URING)
+    uring_ = UringQueue::Instance();
+    direct_fd_ = -1;
+    writing_buffer_ = nullptr;
+    allocated_size_ = 0;
+    is_preallocating_ = true;
+    pending_writes_ = 0;
+    is_syncing_ = false;
+    has_write_error_ = false;
+
+    if (uring_) {
+        writing_buffer_ = AllocateBuffer();
+        if (!writing_buffer_) {
+            uring_ = nullptr;
+        }
+    }
+    if (uring_) {
+        // e.g. tmpfs refuses it, then the blocks are written through the page cache too.
+        direct_fd_ = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    }
+#endif
+}
+
+BufferedFileIO::~BufferedFileIO() {
+    Flush();
+#if defined(USE_IO_URING)
+    if (uring_) {
+        WaitForWrites(true);
+        // releases the preallocated blocks past the end.
+        if (allocated_size_ > file_size_ && ftruncate(fd_, file_size_) < 0) {
+            ERROR_PRINT("Could not trim the recording: %s", strerror(errno));
+        }
+    }
+    if (direct_fd_ >= 0) {
+        close(direct_fd_);
+    }
+    free(writing_buffer_);
+#endif
+    if (fdatasync(fd_) < 0) {
+        ERROR_PRINT("Could not sync the recording: %s", strerror(errno));
+    }
+    close(fd_);
+    free(buffer_);
+}
+
+bool BufferedFileIO::Flush(bool is_all) {
+#if defined(USE_IO_URING)
+    if (uring_) {
+        return FlushAsync(is_all);
+    }
+#endif
+    static LatencyHistogram &latency = LatencyStats::Stage("record_write");
+
+    const uint8_t *data = buffer_ + buffer_start_;
+    size_t written = 0;
+    int64_t start_us = LatencyStats::NowUs();
+    while (written < buffer_length_) {
+        ssize_t ret = pwrite(fd_, data + written, buffer_length_ - written,
+                             buffer_offset_ + written);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            ERROR_PRINT("Could not write the recording: %s", strerror(errno));
+            break;
+        }
+        written += ret;
+    }
+    if (buffer_length_ > 0) {
+        latency.Record(LatencyStats::NowUs() - start_us);
+    }
+
+    file_size_ = std::max(file_size_, buffer_offset_ + (int64_t)written);
+    buffer_offset_ += written;
+    unsynced_bytes_ += written;
+    written_bytes_.fetch_add(written);
+    bool is_complete = written == buffer_length_;
+    buffer_start_ = 0;
+    buffer_length_ = 0;
+
+    SyncIfNeeded();
+    return is_complete;
+}
+
+bool BufferedFileIO::Sync() {
+#if defined(USE_IO_URING)
+    if (uring_) {
+        {
+            std::lock_guard<std::mutex> lock(write_mtx_);
+            if (is_syncing_) {
+                return false;
+            }
+            is_syncing_ = true;
+        }
+        uring_->Fdatasync(fd_, [this](int result) {
+            if (result < 0) {
+                ERROR_PRINT("Could not sync the recording: %s", strerror(-result));
+            }
+            std::lock_guard<std::mutex> lock(write_mtx_);
+            is_syncing_ = false;
+            write_cond_.notify_all();
+        });
+        return true;
+    }
+#endif
+    if (fdatasync(fd_) < 0) {
+        ERROR_PRINT("Could not sync the recording: %s", strerror(errno));
+    }
+    return true;
+}
+
+void BufferedFileIO::SyncIfNeeded() {
+    auto now = std::chrono::steady_clock::now();
+    if (unsynced_bytes_ < kSyncBytes &&
+        now - last_sync_time_ < std::chrono::milliseconds(kSyncIntervalMs)) {
+        return;
+    }
+    if (unsynced_bytes_ > 0 && !Sync()) {
+        // tried again by the next flush.
+        return;
+    }
+    unsynced_bytes_ = 0;
+    last_sync_time_ = now;
+}
+
+int BufferedFileIO::Write(const uint8_t *buf, int buf_size) {
+    int copied = 0;
+    while (copied < buf_size) {
+        if (buffer_start_ + buffer_length_ == kBufferSize && !Flush(false)) {
+            return AVERROR(EIO);
+        }
+        size_t size = std::min(kBufferSize - buffer_start_ - buffer_length_,
+                               (size_t)(buf_size - copied));
+        memcpy(buffer_ + buffer_start_ + buffer_length_, buf + copied, size);
+        buffer_length_ += size;
+        copied += size;
+    }
+    return copied;
+}
+
+int64_t BufferedFileIO::Seek(int64_t offset, int whence) {
+    int64_t end = std::max(file_size_, buffer_offset_ + (int64_t)buffer_length_);
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE) {
+        return end;
+    }
+
+    int64_t position;
+    if (whence == SEEK_SET) {
+        position = offset;
+    } else if (whence == SEEK_CUR) {
+        position = buffer_offset_ + buffer_length_ + offset;
+    } else if (whence == SEEK_END) {
+        position = end + offset;
+    } else {
+        return AVERROR(EINVAL);
+    }
+    if (position < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    // e.g. the mp4 trailer patches the size of the mdat at the front.
+    if (!Flush()) {
+        return AVERROR(EIO);
+    }
+#if defined(USE_IO_URING)
+    if (uring_) {
+        // the patch has to land after the blocks in flight.
+        WaitForWrites();
+        buffer_start_ = direct_fd_ >= 0 ? position % kPageSize : 0;
+    }
+#endif
+    buffer_offset_ = position;
+    return position;
+}
+
+#if defined(USE_IO_URING)
+bool BufferedFileIO::FlushAsync(bool is_all) {
+    // the head up to the first page boundary and the tail are written through the page cache,
+    // the whole pages between them directly.
+    size_t begin = buffer_start_;
+    size_t end = buffer_start_ + buffer_length_;
+    size_t head_end = begin;
+    size_t aligned_end = begin;
+    if (direct_fd_ >= 0) {
+        head_end = std::min((size_t)AlignUp(begin), end);
+        aligned_end = std::max((size_t)AlignDown(end), head_end);
+    }
+    // the partial page is kept unless it's the last one, so the next buffer starts aligned.
+    size_t flush_end = is_all || direct_fd_ < 0 ? end : aligned_end;
+    auto file_offset = [this, begin](size_t pos) {
+        return buffer_offset_ + (int64_t)(pos - begin);
+    };
+
+    // the other buffer is free once its writes are done.
+    WaitForWrites();
+    Preallocate(file_offset(flush_end));
+
+    bool is_submitted = SubmitWrite(fd_, buffer_ + begin, head_end - begin, file_offset(begin));
+    is_submitted &= SubmitWrite(direct_fd_, buffer_ + head_end, aligned_end - head_end,
+                                file_offset(head_end));
+    is_submitted &= SubmitWrite(fd_, buffer_ + aligned_end, flush_end - aligned_end,
+                                file_offset(aligned_end));
+
+    int64_t flushed_offset = file_offset(flush_end);
+    size_t rest = end - flush_end;
+    file_size_ = std::max(file_size_, flushed_offset);
+    unsynced_bytes_ += flush_end - begin;
+    buffer_start_ = direct_fd_ >= 0 ? flushed_offset % kPageSize : 0;
+    memcpy(writing_buffer_ + buffer_start_, buffer_ + flush_end, rest);
+    std::swap(buffer_, writing_buffer_);
+    buffer_offset_ = flushed_offset;
+    buffer_length_ = rest;
+
+    SyncIfNeeded();
+    std::lock_guard<std::mutex> lock(write_mtx_);
+    return is_submitted && !has_write_error_;
+}
+
+bool BufferedFileIO::SubmitWrite(int fd, const uint8_t *data, size_t size, int64_t offset) {
+    if (size == 0) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        pending_writes_++;
+    }
+    int64_t start_us = LatencyStats::NowUs();
+    return uring_->Write(fd, data, size, offset, [this, size, start_us](int result) {
+        static LatencyHistogram &latency = LatencyStats::Stage("record_write");
+        latency.Record(LatencyStats::NowUs() - start_us);
+
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        if (result == (int)size) {
+            written_bytes_.fetch_add(size);
+        } else {
+            ERROR_PRINT("Could not write the recording: %s",
+                        result < 0 ? strerror(-result) : "short write");
+            has_write_error_ = true;
+        }
+        pending_writes_--;
+        write_cond_.notify_all();
+    });
+}
+
+void BufferedFileIO::Preallocate(int64_t end) {
+    {
+        std::lock_guard<std::mutex> lock(write_mtx_);
+        if (!is_preallocating_ || end + (int64_t)kBufferSize <= allocated_size_) {
+            return;
+        }
+        pending_writes_++;
+    }
+    // the size is kept, so a segment cut short doesn't show the unwritten space.
+    uring_->Fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_size_, kPreallocateSize,
+                      [this](int result) {
+                          std::lock_guard<std::mutex> lock(write_mtx_);
+                          if (result < 0) {
+                              // e.g. unsupported, the blocks are allocated as they're written.
+                              is_preallocating_ = false;
+                          }
+                          pending_writes_--;
+                          write_cond_.notify_all();
+                      });
+    allocated_size_ += kPreallocateSize;
+}
+
+void BufferedFileIO::WaitForWrites(bool is_sync_included) {
+    std::unique_lock<std::mutex> lock(write_mtx_);
+    write_cond_.wait(lock, [this, is_sync_included]() {
+        return pending_writes_ == 0 && (!is_sync_included || !is_syncing_);
+    });
+}
+#endif
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int BufferedFileIO::WritePacket(void *opaque, const uint8_t *buf, int buf_size) {
+#else
+int BufferedFileIO::WritePacket(void *opaque, uint8_t *buf, int buf_size) {
+#endif
+    return static_cast<BufferedFileIO *>(opaque)->Write(buf, buf_size);
+}
+
+int64_t BufferedFileIO::SeekPacket(void *opaque, int64_t offset, int whence) {
+    return static_cast<BufferedFileIO *>(opaque)->Seek(offset, whence);
+}
@@ -0,0 +1,99 @@
+#ifndef BUFFERED_FILE_IO_H_
+#define BUFFERED_FILE_IO_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(USE_IO_URING)
+#include <condition_variable>
+#include <mutex>
+
+#include "common/uring_queue.h"
+#endif
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+/* The output of the segments. The muxer's small writes are collected in a large page-aligned
+ * buffer and written to the file in whole blocks, and the written data is synced every few
+ * megabytes or seconds, so the sd card gets a steady stream instead of one long stall when the
+ * kernel decides to write back everything at once.
+ *
+ * With `USE_IO_URING`, a filled buffer is submitted to the ring while the other one is filled,
+ * the aligned blocks go around the page cache by O_DIRECT if the filesystem allows it, and the
+ * file is preallocated ahead of the writes. */
+class BufferedFileIO {
+  public:
+    static const size_t kBufferSize = 1024 * 1024;
+    static const size_t kSyncBytes = 8 * 1024 * 1024;
+    static const int kSyncIntervalMs = 5000;
+    static const int64_t kPreallocateSize = 16 * 1024 * 1024;
+
+    // the context is owned by the caller and released by Close().
+    static AVIOContext *Open(const std::string &path);
+    // flushes, syncs and closes the file, then frees the context.
+    static void Close(AVIOContext **pb);
+    // writes out everything the muxer gave so far and starts syncing it, e.g. a finished
+    // fragment, which is playable on its own and shouldn't wait for the buffer to fill.
+    static bool FlushFragment(AVIOContext *pb);
+    // the bytes written to the files of the process so far.
+    static uint64_t WrittenBytes();
+
+    ~BufferedFileIO();
+
+  private:
+    int fd_;
+    uint8_t *buffer_;
+    // the data is at `buffer_ + buffer_start_`, which is aligned as its file offset is.
+    size_t buffer_start_;
+    size_t buffer_length_;
+    // the file offsets of the first buffered byte, and of the end of the file.
+    int64_t buffer_offset_;
+    int64_t file_size_;
+    size_t unsynced_bytes_;
+    std::chrono::steady_clock::time_point last_sync_time_;
+    AVIOContext *avio_ctx_;
+
+    static std::atomic<uint64_t> written_bytes_;
+
+#if defined(USE_IO_URING)
+    UringQueue *uring_;
+    // opened with O_DIRECT for the aligned blocks, -1 if it's not supported.
+    int direct_fd_;
+    // the one being written by the ring.
+    uint8_t *writing_buffer_;
+    int64_t allocated_size_;
+    bool is_preallocating_;
+    std::mutex write_mtx_;
+    std::condition_variable write_cond_;
+    int pending_writes_;
+    bool is_syncing_;
+    bool has_write_error_;
+
+    bool FlushAsync(bool is_all);
+    bool SubmitWrite(int fd, const uint8_t *data, size_t size, int64_t offset);
+    void Preallocate(int64_t end);
+    void WaitForWrites(bool is_sync_included = false);
+#endif
+
+    BufferedFileIO(const std::string &path, int fd);
+    // writes the buffered data, the last partial block may be kept for the next flush.
+    bool Flush(bool is_all = true);
+    // false if the last one is still running.
+    bool Sync();
+    void SyncIfNeeded();
+    int Write(const uint8_t *buf, int buf_size);
+    int64_t Seek(int64_t offset, int whence);
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+    static int WritePacket(void *opaque, const uint8_t *buf, int buf_size);
+#else
+    static int WritePacket(void *opaque, uint8_t *buf, int buf_size);
+#endif
+    static int64_t SeekPacket(void *opaque, int64_t offset, int whence);
+};
+
+#endif // BUFFERED_FILE_IO_H_
@@ -1,4 +1,5 @@
 #include "recorder/h264_recorder.h"
+#include "common/h264_utils.h"
 
 std::unique_ptr<H264Recorder> H264Recorder::Create(Args config) {
     auto ptr = std::make_unique<H264Recorder>(config, "h264_v4l2m2m");
@@ -8,7 +9,8 @@ std::unique_ptr<H264Recorder> H264Recorder::Create(Args config) {
 
 H264Recorder::H264Recorder(Args config, std::string encoder_name)
     : VideoRecorder(config, encoder_name),
-      abort_(true){};
+      abort_(true),
+      is_key_frame_requested_(false){};
 
 H264Recorder::~H264Recorder() {
     encoder_.reset();
@@ -20,22 +22,29 @@ void H264Recorder::Encode(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
         return;
     }
 
+    bool is_key_frame_requested = is_key_frame_requested_.exchange(false);
     auto i420_buffer = frame_buffer->ToI420();
     if (config.hw_accel) {
+        if (is_key_frame_requested) {
+            V4l2Util::SetExtCtrl(encoder_->GetFd(), V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1);
+        }
         unsigned int i420_buffer_size =
             (i420_buffer->StrideY() * frame_buffer->height()) +
             ((i420_buffer->StrideY() + 1) / 2) * ((frame_buffer->height() + 1) / 2) * 2;
 
-        V4l2Buffer decoded_buffer((void *)i420_buffer->DataY(), i420_buffer_size);
-
-        encoder_->EmplaceBuffer(decoded_buffer, [this, frame_buffer](V4l2Buffer encoded_buffer) {
-            encoded_buffer.timestamp = frame_buffer->timestamp();
-            OnEncoded(encoded_buffer);
-        });
+        // the codec hands the timestamp back with the result to the callback set on reset.
+        V4l2Buffer decoded_buffer((void *)i420_buffer->DataY(), i420_buffer_size, 0,
+                                  frame_buffer->timestamp());
+        encoder_->EmplaceBuffer(decoded_buffer);
     } else {
+        if (is_key_frame_requested) {
+            sw_encoder_->ForceKeyFrame();
+        }
         sw_encoder_->Encode(i420_buffer, [this, frame_buffer](uint8_t *encoded_buffer, int size) {
-            V4l2Buffer buffer((void *)encoded_buffer, size, frame_buffer->flags(),
-                              frame_buffer->timestamp());
+            // the source frame flags don't tell the keyframes of the software encoder.
+            unsigned int flags =
+                H264Util::HasIdrSlice(encoded_buffer, size) ? V4L2_BUF_FLAG_KEYFRAME : 0;
+            V4l2Buffer buffer((void *)encoded_buffer, size, flags, frame_buffer->timestamp());
             OnEncoded(buffer);
         });
     }
@@ -43,12 +52,14 @@ void H264Recorder::Encode(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
 
 void H264Recorder::PreStart() { ResetCodecs(); }
 
+void H264Recorder::RequestKeyFrame() { is_key_frame_requested_.store(true); }
+
 void H264Recorder::ResetCodecs() {
     abort_.store(true);
 
     if (config.hw_accel) {
         encoder_ = std::make_unique<V4l2Encoder>();
-        encoder_->Configure(config.width, config.height, false);
+        encoder_->Configure(config.width, config.height, false, "record_encoder");
         V4l2Util::SetExtCtrl(encoder_->GetFd(), V4L2_CID_MPEG_VIDEO_BITRATE_MODE,
                              V4L2_MPEG_VIDEO_BITRATE_MODE_VBR);
         V4l2Util::SetExtCtrl(encoder_->GetFd(), V4L2_CID_MPEG_VIDEO_H264_LEVEL,
@@ -57,6 +68,9 @@ void H264Recorder::ResetCodecs() {
         V4l2Util::SetExtCtrl(encoder_->GetFd(), V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, 60);
         V4l2Util::SetExtCtrl(encoder_->GetFd(), V4L2_CID_MPEG_VIDEO_BITRATE,
                              config.width * config.height * config.fps * 0.1);
+        encoder_->OnCapture([this](V4l2Buffer &encoded_buffer, uint64_t) {
+            OnEncoded(encoded_buffer);
+        });
         encoder_->Start();
     } else {
         sw_encoder_ = H264Encoder::Create(config);
@@ -14,12 +14,14 @@ class H264Recorder : public VideoRecorder {
     H264Recorder(Args config, std::string encoder_name);
     ~H264Recorder();
     void PreStart() override;
+    void RequestKeyFrame() override;
 
   protected:
     void Encode(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) override;
 
   private:
     std::atomic<bool> abort_;
+    std::atomic<bool> is_key_frame_requested_;
     std::unique_ptr<V4l2Decoder> decoder_;
     std::unique_ptr<V4l2Encoder> encoder_;
     std::unique_ptr<H264Encoder> sw_encoder_;
@@ -0,0 +1,79 @@
+#include "recorder/pre_event_buffer.h"
+
+PreEventBuffer::PreEventBuffer(int duration_ms, size_t max_bytes)
+    : duration_us_((int64_t)duration_ms * 1000),
+      max_bytes_(max_bytes),
+      bytes_(0) {}
+
+PreEventBuffer::~PreEventBuffer() { Clear(); }
+
+void PreEventBuffer::Push(AVPacket *pkt, AVRational time_base, bool is_video) {
+    bool is_keyframe = is_video && (pkt->flags & AV_PKT_FLAG_KEY);
+    if (keyframe_times_.empty() && !is_keyframe) {
+        // nothing can be decoded before the first keyframe.
+        return;
+    }
+
+    AVPacket *copy = av_packet_clone(pkt);
+    if (!copy) {
+        return;
+    }
+
+    int64_t time_us = av_rescale_q(pkt->pts, time_base, AV_TIME_BASE_Q);
+    if (is_keyframe) {
+        keyframe_times_.push_back(time_us);
+    }
+    packets_.push_back({copy, time_base, copy->size, is_keyframe});
+    bytes_ += copy->size;
+
+    Trim(time_us);
+}
+
+void PreEventBuffer::Drain(OnPacketFunc fn) {
+    for (auto &entry : packets_) {
+        fn(entry.pkt, entry.time_base);
+    }
+    Clear();
+}
+
+void PreEventBuffer::Clear() {
+    while (!packets_.empty()) {
+        PopFront();
+    }
+    keyframe_times_.clear();
+}
+
+size_t PreEventBuffer::size() const { return packets_.size(); }
+
+size_t PreEventBuffer::bytes() const { return bytes_; }
+
+void PreEventBuffer::Trim(int64_t latest_us) {
+    // the second GOP alone still covers the duration, so the first one is not needed.
+    while (keyframe_times_.size() >= 2 && latest_us - keyframe_times_[1] >= duration_us_) {
+        DropFrontGop();
+    }
+
+    while (bytes_ > max_bytes_ && keyframe_times_.size() >= 2) {
+        DropFrontGop();
+    }
+
+    if (bytes_ > max_bytes_) {
+        // a single GOP exceeds the limit, start over from the next keyframe.
+        Clear();
+    }
+}
+
+void PreEventBuffer::DropFrontGop() {
+    PopFront();
+    while (!packets_.empty() && !packets_.front().is_keyframe) {
+        PopFront();
+    }
+    keyframe_times_.pop_front();
+}
+
+void PreEventBuffer::PopFront() {
+    auto &entry = packets_.front();
+    bytes_ -= entry.size;
+    av_packet_free(&entry.pkt);
+    packets_.pop_front();
+}
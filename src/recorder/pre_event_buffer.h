@@ -0,0 +1,50 @@
+#ifndef PRE_EVENT_BUFFER_H_
+#define PRE_EVENT_BUFFER_H_
+
+#include <deque>
+#include <functional>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+/* Holds the latest encoded packets in memory while nothing is being recorded.
+ * The buffer always begins at a video keyframe and covers at least `duration_ms` when
+ * possible, whole GOPs are dropped from the front as newer packets arrive. */
+class PreEventBuffer {
+  public:
+    using OnPacketFunc = std::function<void(AVPacket *pkt, AVRational time_base)>;
+
+    PreEventBuffer(int duration_ms, size_t max_bytes);
+    ~PreEventBuffer();
+
+    void Push(AVPacket *pkt, AVRational time_base, bool is_video);
+    // hands the packets over in order, then empties the buffer.
+    void Drain(OnPacketFunc fn);
+    void Clear();
+
+    size_t size() const;
+    size_t bytes() const;
+
+  private:
+    struct Entry {
+        AVPacket *pkt;
+        AVRational time_base;
+        // the muxer may take the data away from the packet while draining.
+        int size;
+        bool is_keyframe;
+    };
+
+    int64_t duration_us_;
+    size_t max_bytes_;
+    size_t bytes_;
+    std::deque<Entry> packets_;
+    // the timestamps of the video keyframes in the buffer, the first one is at the front.
+    std::deque<int64_t> keyframe_times_;
+
+    void Trim(int64_t latest_us);
+    void DropFrontGop();
+    void PopFront();
+};
+
+#endif // PRE_EVENT_BUFFER_H_
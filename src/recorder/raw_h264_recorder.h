@@ -10,14 +10,11 @@ class RawH264Recorder : public VideoRecorder {
     ~RawH264Recorder();
     void PreStart() override;
     void PostStop() override;
-    bool CheckNALUnits(const V4l2Buffer &buffer);
 
   protected:
     void Encode(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) override;
 
   private:
-    bool has_sps_;
-    bool has_pps_;
     bool has_first_keyframe_;
 };
 
@@ -9,13 +9,16 @@ extern "C" {
 }
 
 #include "common/interface/subject.h"
+#include "common/logging.h"
 #include "common/worker.h"
 
 template <typename T> class Recorder {
   public:
     using OnPacketedFunc = std::function<void(AVPacket *pkt)>;
 
-    Recorder() = default;
+    Recorder()
+        : has_pending_(false),
+          dropped_frames_(0) {}
     ~Recorder() { avcodec_free_context(&encoder); };
 
     virtual void OnBuffer(T &buffer) = 0;
@@ -24,14 +27,23 @@ template <typename T> class Recorder {
         avcodec_free_context(&encoder);
         InitializeEncoderCtx(encoder);
         worker.reset(new Worker("Recorder", [this]() {
-            std::unique_lock<std::mutex> lock(mtx_);
-            cond_var_.wait_for(lock, std::chrono::milliseconds(10), [this] {
-                return abort_.load();
-            });
-            ConsumeBuffer();
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                cond_var_.wait(lock, [this] {
+                    return abort_.load() || has_pending_;
+                });
+                has_pending_ = false;
+            }
+            // drain everything queued since the last wake-up in one batch.
+            while (!abort_.load() && ConsumeBuffer()) {
+            }
         }));
     }
 
+    // the number of buffers waiting to be encoded.
+    virtual size_t queue_depth() = 0;
+    uint64_t dropped_frames() const { return dropped_frames_.load(); }
+
     virtual void PostStop(){};
     virtual void PreStart(){};
 
@@ -52,6 +64,11 @@ template <typename T> class Recorder {
         cond_var_.notify_all();
         worker.reset();
         PostStop();
+
+        if (dropped_frames_.load() > 0) {
+            DEBUG_PRINT("Recorder dropped %llu frames, %zu are still queued.",
+                        (unsigned long long)dropped_frames_.load(), queue_depth());
+        }
     }
 
     void Start() {
@@ -74,8 +91,19 @@ template <typename T> class Recorder {
             on_packeted(pkt);
         }
     }
+    // wake up the worker once a new buffer is enqueued.
+    void NotifyBuffer() {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            has_pending_ = true;
+        }
+        cond_var_.notify_one();
+    }
+    void DropFrame() { dropped_frames_.fetch_add(1); }
 
   private:
+    bool has_pending_;
+    std::atomic<uint64_t> dropped_frames_;
     std::atomic<bool> abort_;
     std::mutex mtx_;
     std::condition_variable cond_var_;
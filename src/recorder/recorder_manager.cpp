@@ -1,20 +1,33 @@
 #include "recorder/recorder_manager.h"
 
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <csignal>
 #include <filesystem>
+#include <future>
 #include <mutex>
 #include <thread>
+#include <utility>
 
+#include "common/latency_stats.h"
 #include "common/logging.h"
 #include "common/utils.h"
 #include "common/v4l2_frame_buffer.h"
+#include "recorder/buffered_file_io.h"
 #include "recorder/h264_recorder.h"
 #include "recorder/raw_h264_recorder.h"
 
 const double SECOND_PER_FILE = 60.0;
-const unsigned long MIN_FREE_BYTE = 400 * 1024 * 1024;
+const size_t MAX_PRE_EVENT_BYTE = 16 * 1024 * 1024;
+// the preview is only a thumbnail in the metadata, there is no need for the full frame.
+const int MAX_PREVIEW_WIDTH = 640;
+// the packets waiting for the writer, a few seconds of a stalled sd card.
+const size_t MAX_QUEUED_BYTE = 16 * 1024 * 1024;
+const int WRITER_WAIT_MS = 500;
+const int WRITE_STATS_INTERVAL_SEC = 60;
+// the preview is taken a while into the segment, when the scene is likely to have settled.
+const int PREVIEW_DELAY_SEC = 3;
 
 AVFormatContext *RecUtil::CreateContainer(std::string record_path, std::string filename) {
     AVFormatContext *fmt_ctx = nullptr;
@@ -28,36 +41,61 @@ AVFormatContext *RecUtil::CreateContainer(std::string record_path, std::string f
     }
 
     if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&fmt_ctx->pb, full_path.c_str(), AVIO_FLAG_WRITE) < 0) {
-            ERROR_PRINT("Could not open %s", full_path.c_str());
+        fmt_ctx->pb = BufferedFileIO::Open(full_path);
+        if (!fmt_ctx->pb) {
+            avformat_free_context(fmt_ctx);
             return nullptr;
         }
+        fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
     }
     av_dump_format(fmt_ctx, 0, full_path.c_str(), 1);
 
     return fmt_ctx;
 }
 
-bool RecUtil::WriteFormatHeader(AVFormatContext *fmt_ctx) {
-    if (avformat_write_header(fmt_ctx, nullptr) < 0) {
+bool RecUtil::WriteFormatHeader(AVFormatContext *fmt_ctx, bool is_fragmented) {
+    AVDictionary *opts = nullptr;
+    if (is_fragmented) {
+        // the moov is written up front, and the fragments are cut by FlushFragment().
+        av_dict_set(&opts, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+    }
+    int ret = avformat_write_header(fmt_ctx, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
         ERROR_PRINT("Error occurred when opening output file");
         return false;
     }
     return true;
 }
 
+void RecUtil::FlushFragment(AVFormatContext *fmt_ctx) {
+    // write the packets still waiting for interleaving, then close the fragment with them.
+    av_interleaved_write_frame(fmt_ctx, nullptr);
+    av_write_frame(fmt_ctx, nullptr);
+    // the buffered io would keep a small fragment in memory until its buffer is full.
+    if (!BufferedFileIO::FlushFragment(fmt_ctx->pb)) {
+        ERROR_PRINT("Could not write the fragment of %s", fmt_ctx->url);
+    }
+}
+
 void RecUtil::CloseContext(AVFormatContext *fmt_ctx) {
     if (fmt_ctx) {
         av_write_trailer(fmt_ctx);
-        avio_closep(&fmt_ctx->pb);
+        BufferedFileIO::Close(&fmt_ctx->pb);
         avformat_free_context(fmt_ctx);
     }
 }
 
-std::unique_ptr<RecorderManager> RecorderManager::Create(std::shared_ptr<VideoCapturer> video_src,
-                                                         std::shared_ptr<PaCapturer> audio_src,
-                                                         std::string record_path) {
-    auto instance = std::make_unique<RecorderManager>(record_path);
+std::unique_ptr<RecorderManager>
+RecorderManager::Create(std::shared_ptr<VideoCapturer> video_src,
+                        std::shared_ptr<PaCapturer> audio_src, std::string record_path,
+                        std::shared_ptr<RecordingCatalog> catalog,
+                        std::shared_ptr<EncodedVideoSource> encoded_src) {
+    if (!catalog) {
+        catalog = RecordingCatalog::Create(record_path);
+    }
+    auto instance = std::make_unique<RecorderManager>(record_path, catalog);
+    instance->encoded_src_ = encoded_src;
 
     if (video_src) {
         instance->CreateVideoRecorder(video_src);
@@ -68,7 +106,8 @@ std::unique_ptr<RecorderManager> RecorderManager::Create(std::shared_ptr<VideoCa
         instance->SubscribeAudioSource(audio_src);
     }
 
-    instance->StartRotationThread();
+    instance->StartWriterThread();
+    instance->StartPreviewThread();
 
     return instance;
 }
@@ -78,8 +117,20 @@ void RecorderManager::CreateVideoRecorder(std::shared_ptr<VideoCapturer> capture
     fps = capturer->fps();
     width = capturer->width();
     height = capturer->height();
-    video_recorder = ([capturer]() -> std::unique_ptr<VideoRecorder> {
-        if (capturer->format() == V4L2_PIX_FMT_H264) {
+    fragment_ms_ = capturer->config().record_fragment_ms;
+    is_triggered_ = capturer->config().record_on_trigger;
+    post_event_ms_ = capturer->config().record_post_event_sec * 1000;
+    if (is_triggered_) {
+        pre_event_buffer_ = std::make_unique<PreEventBuffer>(
+            capturer->config().record_pre_event_sec * 1000, MAX_PRE_EVENT_BYTE);
+    }
+    video_recorder = ([this, capturer]() -> std::unique_ptr<VideoRecorder> {
+        if (encoded_src_) {
+            // the shared encoder's output is muxed like the camera h264.
+            auto config = capturer->config();
+            config.format = V4L2_PIX_FMT_H264;
+            return RawH264Recorder::Create(config);
+        } else if (capturer->format() == V4L2_PIX_FMT_H264) {
             return RawH264Recorder::Create(capturer->config());
         } else {
             return H264Recorder::Create(capturer->config());
@@ -93,51 +144,134 @@ void RecorderManager::CreateAudioRecorder(std::shared_ptr<PaCapturer> capturer)
     })();
 }
 
-RecorderManager::RecorderManager(std::string record_path)
+RecorderManager::RecorderManager(std::string record_path,
+                                 std::shared_ptr<RecordingCatalog> catalog)
     : fmt_ctx(nullptr),
       has_first_keyframe(false),
       record_path(record_path),
-      elapsed_time_(0.0) {}
-
-void RecorderManager::StartRotationThread() {
-    rotation_worker_.reset(new Worker("Record Rotation", [this]() {
-        while (!Utils::CheckDriveSpace(record_path, MIN_FREE_BYTE)) {
-            Utils::RotateFiles(record_path);
+      catalog(catalog),
+      elapsed_time_(0.0),
+      fragment_ms_(0),
+      fragment_start_pts_(AV_NOPTS_VALUE),
+      source_ctx_(nullptr),
+      segment_offset_us_(AV_NOPTS_VALUE),
+      is_triggered_(false),
+      is_event_pending_(false),
+      post_event_ms_(0),
+      is_key_frame_requested_(false),
+      queued_bytes_(0),
+      is_trigger_requested_(false),
+      is_dropping_video_(false),
+      dropped_packets_(0),
+      last_written_bytes_(0),
+      last_stats_time_(std::chrono::steady_clock::now()),
+      is_preview_stopped_(false) {}
+
+void RecorderManager::StartWriterThread() {
+    writer_worker_.reset(new Worker("Record Writer", [this]() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mtx_);
+            queue_cond_.wait_for(lock, std::chrono::milliseconds(WRITER_WAIT_MS), [this]() {
+                return !packet_queue_.empty() || is_trigger_requested_;
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lock(ctx_mux);
+            WriteQueuedPackets();
         }
-        sleep(60);
+        ReportWriteStats();
     }));
-    rotation_worker_->Run();
+    writer_worker_->Run();
 }
 
-void RecorderManager::SubscribeVideoSource(std::shared_ptr<VideoCapturer> video_src) {
-    video_observer = video_src->AsRawBufferObservable();
-    video_observer->Subscribe([this](V4l2Buffer buffer) {
-        // waiting first keyframe to start recorders.
-        if (!has_first_keyframe && ((buffer.flags & V4L2_BUF_FLAG_KEYFRAME) ||
-                                    video_src_->format() != V4L2_PIX_FMT_H264)) {
-            Start();
-            last_created_time_ = buffer.timestamp;
+void RecorderManager::StartPreviewThread() {
+    // one thread for all the previews, so its jpeg compressor is set up only once.
+    preview_worker_.reset(new Worker("Record Preview", [this]() {
+        std::string url;
+        {
+            std::unique_lock<std::mutex> lock(preview_mtx_);
+            preview_cond_.wait(lock, [this]() {
+                return is_preview_stopped_ || !preview_requests_.empty();
+            });
+            if (is_preview_stopped_ ||
+                preview_cond_.wait_until(lock, preview_requests_.front().first,
+                                         [this]() { return is_preview_stopped_; })) {
+                return;
+            }
+            // all are due after the same delay, so the later requests never move to the front.
+            url = std::move(preview_requests_.front().second);
+            preview_requests_.pop_front();
         }
-
-        // restart to write in the new file.
-        if (elapsed_time_ >= SECOND_PER_FILE && buffer.flags & V4L2_BUF_FLAG_KEYFRAME) {
-            last_created_time_ = buffer.timestamp;
-            Stop();
-            Start();
+        auto i420buff = video_src_ ? video_src_->GetI420Frame() : nullptr;
+        if (!i420buff) {
+            return;
         }
+        Utils::CreateJpegImage(i420buff, ReplaceExtension(url, ".jpg"),
+                               std::min(i420buff->width(), MAX_PREVIEW_WIDTH));
+    }));
+    preview_worker_->Run();
+}
 
-        if (has_first_keyframe && video_recorder) {
-            video_recorder->OnBuffer(buffer);
-            elapsed_time_ = (buffer.timestamp.tv_sec - last_created_time_.tv_sec) +
-                            (buffer.timestamp.tv_usec - last_created_time_.tv_usec) / 1000000.0;
-        }
-    });
+void RecorderManager::SubscribeVideoSource(std::shared_ptr<VideoCapturer> video_src) {
+    if (encoded_src_) {
+        video_observer = encoded_src_->AsEncodedObservable();
+        video_observer->Subscribe([this](V4l2Buffer buffer) {
+            if (OnVideoFrame(buffer.flags)) {
+                video_recorder->OnBuffer(buffer);
+            }
+        });
+    } else if (!video_src->config().hw_accel && video_src->format() != V4L2_PIX_FMT_H264) {
+        // record the same frame objects as the track, so each frame is converted to i420 once.
+        frame_buffer_observer = video_src->AsFrameBufferObservable();
+        frame_buffer_observer->Subscribe([this](rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
+            if (OnVideoFrame(frame_buffer->flags())) {
+                video_recorder->OnFrameBuffer(frame_buffer);
+            }
+        });
+    } else {
+        video_observer = video_src->AsRawBufferObservable();
+        video_observer->Subscribe([this](V4l2Buffer buffer) {
+            if (OnVideoFrame(buffer.flags)) {
+                video_recorder->OnBuffer(buffer);
+            }
+        });
+    }
 
     video_recorder->OnPacketed([this](AVPacket *pkt) {
-        this->WriteIntoFile(pkt);
+        this->WriteIntoFile(pkt, true);
     });
 }
 
+bool RecorderManager::OnVideoFrame(unsigned int flags) {
+    bool is_encoded = encoded_src_ || video_src_->format() == V4L2_PIX_FMT_H264;
+
+    // waiting first keyframe to start recorders.
+    if (!has_first_keyframe && !(flags & V4L2_BUF_FLAG_KEYFRAME) && is_encoded) {
+        RequestKeyFrame();
+    }
+    if (!has_first_keyframe && ((flags & V4L2_BUF_FLAG_KEYFRAME) || !is_encoded)) {
+        Start();
+    }
+
+    // the segments are opened and closed by the packets, the recorders keep running.
+    return has_first_keyframe && video_recorder;
+}
+
+void RecorderManager::RequestKeyFrame() {
+    // once until the keyframe is written, the encoders take a few frames to produce it.
+    if (is_key_frame_requested_.exchange(true)) {
+        return;
+    }
+    if (encoded_src_) {
+        encoded_src_->RequestKeyFrame();
+    } else if (video_src_ && video_src_->format() == V4L2_PIX_FMT_H264) {
+        // the camera's own h264 is passed through, so its encoder is asked.
+        video_src_->RequestKeyFrame();
+    } else if (video_recorder) {
+        video_recorder->RequestKeyFrame();
+    }
+}
+
 void RecorderManager::SubscribeAudioSource(std::shared_ptr<PaCapturer> audio_src) {
     audio_observer = audio_src->AsObservable();
     audio_observer->Subscribe([this](PaBuffer buffer) {
@@ -147,44 +281,191 @@ void RecorderManager::SubscribeAudioSource(std::shared_ptr<PaCapturer> audio_src
     });
 
     audio_recorder->OnPacketed([this](AVPacket *pkt) {
-        this->WriteIntoFile(pkt);
+        this->WriteIntoFile(pkt, false);
     });
 }
 
-void RecorderManager::WriteIntoFile(AVPacket *pkt) {
-    std::lock_guard<std::mutex> lock(ctx_mux);
+void RecorderManager::WriteIntoFile(AVPacket *pkt, bool is_video) {
+    bool is_keyframe = is_video && (pkt->flags & AV_PKT_FLAG_KEY);
+    bool is_dropped = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        if (is_video && is_dropping_video_ && !is_keyframe) {
+            // the following frames refer to the dropped one.
+            is_dropped = true;
+        } else if (queued_bytes_ + pkt->size > MAX_QUEUED_BYTE) {
+            is_dropped = true;
+            is_dropping_video_ |= is_video;
+        } else if (AVPacket *queued = av_packet_clone(pkt)) {
+            if (is_keyframe) {
+                is_dropping_video_ = false;
+            }
+            queued_bytes_ += queued->size;
+            packet_queue_.push_back(queued);
+        }
+        if (is_dropped) {
+            dropped_packets_++;
+        }
+    }
+
+    if (!is_dropped) {
+        queue_cond_.notify_one();
+    } else if (is_video) {
+        // resume from a new gop instead of waiting out the current one.
+        RequestKeyFrame();
+    }
+}
+
+void RecorderManager::WriteQueuedPackets() {
+    std::deque<AVPacket *> batch;
+    bool is_trigger_requested;
+    std::chrono::steady_clock::time_point trigger_time;
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        batch.swap(packet_queue_);
+        queued_bytes_ = 0;
+        is_trigger_requested = std::exchange(is_trigger_requested_, false);
+        trigger_time = trigger_time_;
+    }
+    if (is_trigger_requested) {
+        // before the batch, which was queued by the time it's triggered.
+        OnTrigger(trigger_time);
+    }
+    for (auto *pkt : batch) {
+        MuxPacket(pkt);
+        av_packet_free(&pkt);
+    }
+}
+
+void RecorderManager::ReportWriteStats() {
+    static LatencyHistogram &latency = LatencyStats::Stage("record_write");
+
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>(now - last_stats_time_).count();
+    if (elapsed < WRITE_STATS_INTERVAL_SEC) {
+        return;
+    }
+    uint64_t written_bytes = BufferedFileIO::WrittenBytes();
+    uint64_t dropped_packets;
+    size_t queued_bytes;
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        dropped_packets = dropped_packets_;
+        queued_bytes = queued_bytes_;
+    }
+    DEBUG_PRINT("Record writer: %.1f KB/s, write p99/max: %lld/%lld us, queued: %zu bytes, "
+                "dropped: %llu packets.",
+                (written_bytes - last_written_bytes_) / elapsed / 1024,
+                (long long)latency.Percentile(99), (long long)latency.max(), queued_bytes,
+                (unsigned long long)dropped_packets);
+    last_written_bytes_ = written_bytes;
+    last_stats_time_ = now;
+}
+
+void RecorderManager::MuxPacket(AVPacket *pkt) {
+    if (!source_ctx_ || source_ctx_->nb_streams <= pkt->stream_index) {
+        return;
+    }
+    auto *st = source_ctx_->streams[pkt->stream_index];
+    bool is_video = st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    bool is_keyframe = is_video && (pkt->flags & AV_PKT_FLAG_KEY);
+    if (is_keyframe) {
+        is_key_frame_requested_.store(false);
+    }
+
+    if (fmt_ctx && is_video) {
+        bool is_expired = is_triggered_ && std::chrono::steady_clock::now() >= event_deadline_;
+        bool is_full = elapsed_time_ >= SECOND_PER_FILE;
+        if (!is_keyframe) {
+            if (is_expired || is_full) {
+                RequestKeyFrame();
+            }
+        } else if (is_expired) {
+            // end at a keyframe, so the buffering continues seamlessly from this GOP.
+            CloseSegment(true);
+        } else if (is_full) {
+            // only the container is switched, the encoders keep running through it.
+            CloseSegment(true);
+            OpenSegment();
+        }
+    }
+
+    if (fmt_ctx) {
+        WriteSegmentPacket(pkt, st->time_base);
+    } else if (!is_triggered_) {
+        // the first segment, or the next one if the last could not be opened.
+        if (is_keyframe && OpenSegment()) {
+            WriteSegmentPacket(pkt, st->time_base);
+        }
+    } else {
+        pre_event_buffer_->Push(pkt, st->time_base, is_video);
+        if (is_event_pending_ && pre_event_buffer_->size() > 0) {
+            StartEvent();
+        }
+    }
+}
+
+void RecorderManager::WritePacket(AVPacket *pkt) {
+    if (fragment_ms_ > 0 && IsFragmentBoundary(pkt)) {
+        RecUtil::FlushFragment(fmt_ctx);
+    }
+
     int ret;
-    if (fmt_ctx && fmt_ctx->nb_streams > pkt->stream_index &&
-        (ret = av_interleaved_write_frame(fmt_ctx, pkt)) < 0) {
+    if ((ret = av_interleaved_write_frame(fmt_ctx, pkt)) < 0) {
         char err_buf[AV_ERROR_MAX_STRING_SIZE];
         av_strerror(ret, err_buf, sizeof(err_buf));
         fprintf(stderr, "Error occurred: %s\n", err_buf);
     }
 }
 
+bool RecorderManager::IsFragmentBoundary(AVPacket *pkt) {
+    auto *st = fmt_ctx->streams[pkt->stream_index];
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+        return false;
+    }
+
+    if (fragment_start_pts_ == AV_NOPTS_VALUE) {
+        // the segment begins with this keyframe, there is nothing to flush yet.
+        fragment_start_pts_ = pkt->pts;
+        return false;
+    }
+
+    int64_t elapsed_ms = av_rescale_q(pkt->pts - fragment_start_pts_, st->time_base, {1, 1000});
+    if (elapsed_ms < fragment_ms_) {
+        return false;
+    }
+    fragment_start_pts_ = pkt->pts;
+    return true;
+}
+
 void RecorderManager::Start() {
-    if (!Utils::CheckDriveSpace(record_path, 100)) {
-        DEBUG_PRINT("Skip recording since not enough free space!");
+    std::lock_guard<std::mutex> lock(ctx_mux);
+    // the container is never written, it only provides the streams to stamp the packets, so
+    // the recorders are started once and the segments are switched without them.
+    if (avformat_alloc_output_context2(&source_ctx_, nullptr, "mp4", nullptr) < 0) {
+        ERROR_PRINT("Could not alloc the source context");
         return;
     }
 
-    std::lock_guard<std::mutex> lock(ctx_mux);
-    auto file_info = Utils::GenerateFilename();
-    auto folder = record_path + file_info.date + "/" + file_info.hour;
-    Utils::CreateFolder(folder);
-    fmt_ctx = RecUtil::CreateContainer(folder, file_info.filename);
+    if (video_recorder) {
+        video_recorder->AddStream(source_ctx_);
+    }
+    if (audio_recorder) {
+        audio_recorder->AddStream(source_ctx_);
+    }
+    for (unsigned int i = 0; i < source_ctx_->nb_streams; i++) {
+        auto *st = source_ctx_->streams[i];
+        st->time_base = st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO
+                            ? AVRational{1, st->codecpar->sample_rate}
+                            : AVRational{1, 90000};
+    }
 
     if (video_recorder) {
-        video_recorder->AddStream(fmt_ctx);
         video_recorder->Start();
     }
     if (audio_recorder) {
-        audio_recorder->AddStream(fmt_ctx);
         audio_recorder->Start();
     }
-    RecUtil::WriteFormatHeader(fmt_ctx);
-
-    MakePreviewImage();
 
     has_first_keyframe = true;
 }
@@ -197,33 +478,221 @@ void RecorderManager::Stop() {
         audio_recorder->Stop();
     }
 
+    {
+        // an event which hasn't begun yet isn't started only to be closed.
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        is_trigger_requested_ = false;
+    }
+    std::lock_guard<std::mutex> lock(ctx_mux);
+    // the recorders are stopped, so these are the last packets of the segment.
+    WriteQueuedPackets();
+    CloseSegment();
+    WaitForClosingTasks();
+    if (source_ctx_) {
+        avformat_free_context(source_ctx_);
+        source_ctx_ = nullptr;
+    }
+    if (pre_event_buffer_) {
+        pre_event_buffer_->Clear();
+    }
+    is_event_pending_ = false;
+    has_first_keyframe = false;
+}
+
+void RecorderManager::CloseSegment(bool is_async) {
+    if (!fmt_ctx) {
+        return;
+    }
+    auto metadata = MakeMetadata();
+    AVFormatContext *closing_ctx = fmt_ctx;
+    fmt_ctx = nullptr;
+    if (!is_async) {
+        RecUtil::CloseContext(closing_ctx);
+        closing_ctx = nullptr;
+    }
+    SaveMetadata(std::move(metadata), closing_ctx);
+}
+
+void RecorderManager::Trigger() {
+    if (!is_triggered_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx_);
+        is_trigger_requested_ = true;
+        trigger_time_ = std::chrono::steady_clock::now();
+    }
+    queue_cond_.notify_one();
+}
+
+void RecorderManager::OnTrigger(std::chrono::steady_clock::time_point trigger_time) {
+    if (!source_ctx_) {
+        return;
+    }
+
+    event_deadline_ = trigger_time + std::chrono::milliseconds(post_event_ms_);
     if (fmt_ctx) {
-        std::lock_guard<std::mutex> lock(ctx_mux);
-        RecUtil::CloseContext(fmt_ctx);
+        // only extends the event being recorded.
+        return;
+    }
+
+    DEBUG_PRINT("Recording is triggered with %zu buffered packets (%zu bytes).",
+                pre_event_buffer_->size(), pre_event_buffer_->bytes());
+    is_event_pending_ = true;
+    if (pre_event_buffer_->size() > 0) {
+        StartEvent();
+    }
+}
+
+void RecorderManager::StartEvent() {
+    is_event_pending_ = false;
+    if (!OpenSegment()) {
+        return;
+    }
+    pre_event_buffer_->Drain([this](AVPacket *pkt, AVRational time_base) {
+        WriteSegmentPacket(pkt, time_base);
+    });
+}
+
+bool RecorderManager::OpenSegment() {
+    if (!Utils::CheckDriveSpace(record_path, 100)) {
+        DEBUG_PRINT("Skip recording since not enough free space!");
+        return false;
+    }
+
+    auto file_info = Utils::GenerateFilename();
+    auto folder = record_path + file_info.date + "/" + file_info.hour;
+    Utils::CreateFolder(folder);
+    fmt_ctx = RecUtil::CreateContainer(folder, file_info.filename);
+    if (!fmt_ctx) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < source_ctx_->nb_streams; i++) {
+        auto *in = source_ctx_->streams[i];
+        auto *out = avformat_new_stream(fmt_ctx, nullptr);
+        avcodec_parameters_copy(out->codecpar, in->codecpar);
+        out->time_base = in->time_base;
+    }
+    if (!RecUtil::WriteFormatHeader(fmt_ctx, fragment_ms_ > 0)) {
+        BufferedFileIO::Close(&fmt_ctx->pb);
+        avformat_free_context(fmt_ctx);
         fmt_ctx = nullptr;
+        return false;
+    }
+
+    fragment_start_pts_ = AV_NOPTS_VALUE;
+    // the first packet written is a keyframe, which becomes the zero time of the segment.
+    segment_offset_us_ = AV_NOPTS_VALUE;
+    elapsed_time_ = 0.0;
+    MakePreviewImage();
+    return true;
+}
+
+void RecorderManager::WriteSegmentPacket(AVPacket *pkt, AVRational time_base) {
+    int64_t pts_us = av_rescale_q(pkt->pts, time_base, AV_TIME_BASE_Q);
+    int64_t dts_us = av_rescale_q(pkt->dts, time_base, AV_TIME_BASE_Q);
+    if (segment_offset_us_ == AV_NOPTS_VALUE) {
+        segment_offset_us_ = pts_us;
+    }
+    if (dts_us < segment_offset_us_) {
+        // e.g. the audio encoded slightly before the first keyframe.
+        return;
     }
+
+    auto *st = fmt_ctx->streams[pkt->stream_index];
+    pkt->pts = av_rescale_q(pts_us - segment_offset_us_, AV_TIME_BASE_Q, st->time_base);
+    pkt->dts = av_rescale_q(dts_us - segment_offset_us_, AV_TIME_BASE_Q, st->time_base);
+    pkt->duration = av_rescale_q(pkt->duration, time_base, st->time_base);
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+        elapsed_time_ = (pts_us - segment_offset_us_) / 1000000.0;
+    }
+    WritePacket(pkt);
 }
 
 RecorderManager::~RecorderManager() {
     printf("~RecorderManager\n");
+    if (video_observer) {
+        video_observer->UnSubscribe();
+    }
     Stop();
+    {
+        std::lock_guard<std::mutex> lock(preview_mtx_);
+        is_preview_stopped_ = true;
+    }
+    preview_cond_.notify_all();
+    preview_worker_.reset();
     video_recorder.reset();
     audio_recorder.reset();
     video_observer.reset();
+    frame_buffer_observer.reset();
     audio_observer.reset();
-    rotation_worker_.reset();
+    writer_worker_.reset();
+
+    // queued after the last write, nothing is going to mux them anymore.
+    std::lock_guard<std::mutex> lock(queue_mtx_);
+    for (auto *pkt : packet_queue_) {
+        av_packet_free(&pkt);
+    }
+    packet_queue_.clear();
+    queued_bytes_ = 0;
 }
 
-void RecorderManager::MakePreviewImage() {
-    std::thread([this]() {
-        std::this_thread::sleep_for(std::chrono::seconds(3));
-        if (video_src_ == nullptr) {
-            return;
+RecordingMetadata RecorderManager::MakeMetadata() {
+    RecordingMetadata metadata;
+    metadata.path = fmt_ctx->url;
+    metadata.duration = std::round(elapsed_time_);
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++) {
+        auto *codecpar = fmt_ctx->streams[i]->codecpar;
+        if (codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            metadata.codec = avcodec_get_name(codecpar->codec_id);
+            metadata.width = codecpar->width;
+            metadata.height = codecpar->height;
         }
-        auto i420buff = video_src_->GetI420Frame();
-        Utils::CreateJpegImage(i420buff->DataY(), i420buff->width(), i420buff->height(),
-                               ReplaceExtension(fmt_ctx->url, ".jpg"));
-    }).detach();
+    }
+    return metadata;
+}
+
+void RecorderManager::SaveMetadata(RecordingMetadata metadata, AVFormatContext *closing_ctx) {
+    // keep the file io away from the capturing thread.
+    auto task = [catalog = catalog, metadata = std::move(metadata), closing_ctx]() mutable {
+        // nothing else refers to it, the trailer is written here while the next one is filled.
+        RecUtil::CloseContext(closing_ctx);
+        std::error_code ec;
+        metadata.size = std::filesystem::file_size(metadata.path, ec);
+        metadata.LoadImage(std::filesystem::path(metadata.path).replace_extension(".jpg").string());
+        metadata.Save();
+        catalog->Upsert(metadata.path, metadata.duration);
+    };
+
+    std::lock_guard<std::mutex> lock(closing_mtx_);
+    // the finished ones are dropped here, the rest are waited for by Stop().
+    closing_tasks_.remove_if([](std::future<void> &task) {
+        return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    });
+    closing_tasks_.push_back(std::async(std::launch::async, std::move(task)));
+}
+
+void RecorderManager::WaitForClosingTasks() {
+    std::list<std::future<void>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(closing_mtx_);
+        tasks.swap(closing_tasks_);
+    }
+    for (auto &task : tasks) {
+        task.wait();
+    }
+}
+
+void RecorderManager::MakePreviewImage() {
+    // the segment may be closed before the image is taken, so keep its url now.
+    {
+        std::lock_guard<std::mutex> lock(preview_mtx_);
+        preview_requests_.emplace_back(std::chrono::steady_clock::now() +
+                                           std::chrono::seconds(PREVIEW_DELAY_SEC),
+                                       fmt_ctx->url);
+    }
+    preview_cond_.notify_one();
 }
 
 std::string RecorderManager::ReplaceExtension(const std::string &url,
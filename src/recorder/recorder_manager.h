@@ -1,6 +1,12 @@
 #ifndef RECODER_MANAGER_H_
 #define RECODER_MANAGER_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
 #include <mutex>
 
 extern "C" {
@@ -12,27 +18,37 @@ extern "C" {
 
 #include "capturer/pa_capturer.h"
 #include "capturer/video_capturer.h"
+#include "common/interface/encoded_video_source.h"
 #include "common/worker.h"
 #include "recorder/audio_recorder.h"
+#include "recorder/pre_event_buffer.h"
+#include "recorder/recording_catalog.h"
 #include "recorder/video_recorder.h"
 
 class RecUtil {
   public:
     static AVFormatContext *CreateContainer(std::string record_path, std::string filename);
-    static bool WriteFormatHeader(AVFormatContext *fmt_ctx);
+    static bool WriteFormatHeader(AVFormatContext *fmt_ctx, bool is_fragmented = false);
+    static void FlushFragment(AVFormatContext *fmt_ctx);
     static void CloseContext(AVFormatContext *fmt_ctx);
 };
 
 class RecorderManager {
   public:
-    static std::unique_ptr<RecorderManager> Create(std::shared_ptr<VideoCapturer> video_src,
-                                                   std::shared_ptr<PaCapturer> audio_src,
-                                                   std::string record_path);
-    RecorderManager(std::string record_path);
+    // the bitstream of `encoded_src` is recorded if given, instead of encoding the frames again.
+    static std::unique_ptr<RecorderManager>
+    Create(std::shared_ptr<VideoCapturer> video_src, std::shared_ptr<PaCapturer> audio_src,
+           std::string record_path, std::shared_ptr<RecordingCatalog> catalog = nullptr,
+           std::shared_ptr<EncodedVideoSource> encoded_src = nullptr);
+    RecorderManager(std::string record_path, std::shared_ptr<RecordingCatalog> catalog);
     ~RecorderManager();
-    void WriteIntoFile(AVPacket *pkt);
+    // only queues the packet, the files are written by the writer thread.
+    void WriteIntoFile(AVPacket *pkt, bool is_video);
     void Start();
     void Stop();
+    // starts or extends an event in the `record_on_trigger` mode, it's ignored otherwise. It
+    // only hands the request to the writer thread, so a stalled card never blocks the caller.
+    void Trigger();
 
   protected:
     std::mutex ctx_mux;
@@ -43,9 +59,11 @@ class RecorderManager {
     AVFormatContext *fmt_ctx;
     bool has_first_keyframe;
     std::shared_ptr<Observable<V4l2Buffer>> video_observer;
+    std::shared_ptr<Observable<rtc::scoped_refptr<V4l2FrameBuffer>>> frame_buffer_observer;
     std::shared_ptr<Observable<PaBuffer>> audio_observer;
     std::unique_ptr<VideoRecorder> video_recorder;
     std::unique_ptr<AudioRecorder> audio_recorder;
+    std::shared_ptr<RecordingCatalog> catalog;
 
     void CreateVideoRecorder(std::shared_ptr<VideoCapturer> video_src);
     void CreateAudioRecorder(std::shared_ptr<PaCapturer> aduio_src);
@@ -54,12 +72,66 @@ class RecorderManager {
 
   private:
     double elapsed_time_;
-    struct timeval last_created_time_;
-    std::unique_ptr<Worker> rotation_worker_;
+    int fragment_ms_;
+    int64_t fragment_start_pts_;
+
+    // the recorders stamp packets by the streams of `source_ctx_`, which outlives the segments.
+    AVFormatContext *source_ctx_;
+    int64_t segment_offset_us_;
+
+    // the triggered mode.
+    bool is_triggered_;
+    bool is_event_pending_;
+    int post_event_ms_;
+    std::chrono::steady_clock::time_point event_deadline_;
+    std::unique_ptr<PreEventBuffer> pre_event_buffer_;
     std::shared_ptr<VideoCapturer> video_src_;
+    std::shared_ptr<EncodedVideoSource> encoded_src_;
+    std::atomic<bool> is_key_frame_requested_;
+
+    // the writer thread, which keeps the storage stalls away from the encoders.
+    std::mutex queue_mtx_;
+    std::condition_variable queue_cond_;
+    std::deque<AVPacket *> packet_queue_;
+    size_t queued_bytes_;
+    bool is_trigger_requested_;
+    std::chrono::steady_clock::time_point trigger_time_;
+    bool is_dropping_video_;
+    uint64_t dropped_packets_;
+    uint64_t last_written_bytes_;
+    std::chrono::steady_clock::time_point last_stats_time_;
+    std::unique_ptr<Worker> writer_worker_;
+
+    // the urls of the segments waiting for their preview images, by when they're due.
+    std::mutex preview_mtx_;
+    std::condition_variable preview_cond_;
+    bool is_preview_stopped_;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> preview_requests_;
+    std::unique_ptr<Worker> preview_worker_;
+
+    // the closed segments are finished and indexed in the background, until Stop() waits.
+    std::mutex closing_mtx_;
+    std::list<std::future<void>> closing_tasks_;
 
-    void StartRotationThread();
+    void StartWriterThread();
+    void StartPreviewThread();
+    void WriteQueuedPackets();
+    void ReportWriteStats();
+    void MuxPacket(AVPacket *pkt);
+    bool OnVideoFrame(unsigned int flags);
+    void RequestKeyFrame();
+    bool IsFragmentBoundary(AVPacket *pkt);
+    void WritePacket(AVPacket *pkt);
+    bool OpenSegment();
+    // the async one leaves the trailer and the file closing to the metadata thread.
+    void CloseSegment(bool is_async = false);
+    void OnTrigger(std::chrono::steady_clock::time_point trigger_time);
+    void StartEvent();
+    void WriteSegmentPacket(AVPacket *pkt, AVRational time_base);
     void MakePreviewImage();
+    RecordingMetadata MakeMetadata();
+    void SaveMetadata(RecordingMetadata metadata, AVFormatContext *closing_ctx = nullptr);
+    void WaitForClosingTasks();
     std::string ReplaceExtension(const std::string &url, const std::string &new_extension);
 };
 
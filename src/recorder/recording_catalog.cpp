@@ -0,0 +1,385 @@
+#include "recorder/recording_catalog.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "common/logging.h"
+#include "common/utils.h"
+
+// the folders are `record_path/date/hour/`, only the hour folders contain the recordings.
+static const int kHourFolderDepth = 2;
+static const int kMaxEstimatedDuration = 24 * 60 * 60;
+static const int kPollTimeoutMs = 500;
+static const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_ONLYDIR;
+
+static std::string NormalizePath(const fs::path &path) {
+    auto normal_path = path.lexically_normal();
+    if (!normal_path.has_filename() && normal_path.has_relative_path()) {
+        // drop the trailing separator, e.g. the record path given by the parser.
+        normal_path = normal_path.parent_path();
+    }
+    return normal_path.string();
+}
+
+static int EstimateDuration(const fs::path &path, fs::file_time_type last_write_time) {
+    // the filename is the local start time, and the file is last written at the end.
+    auto stem = path.stem().string();
+    if (stem.length() < 15) {
+        return -1;
+    }
+    auto end_time = fs::file_time_type::clock::to_sys(last_write_time);
+    auto seconds =
+        std::chrono::duration_cast<std::chrono::seconds>(end_time - Utils::ParseDatetime(stem))
+            .count();
+    return (seconds >= 0 && seconds < kMaxEstimatedDuration) ? seconds : -1;
+}
+
+static std::optional<RecordingEntry> StatRecording(const fs::path &path) {
+    std::error_code ec;
+    RecordingEntry entry;
+    entry.path = NormalizePath(path);
+    entry.size = fs::file_size(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    entry.last_write_time = fs::last_write_time(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    auto image_path = fs::path(path).replace_extension(".jpg");
+    if (fs::exists(image_path, ec)) {
+        entry.thumbnail_path = NormalizePath(image_path);
+    }
+    entry.duration = EstimateDuration(path, entry.last_write_time);
+    return entry;
+}
+
+std::shared_ptr<RecordingCatalog> RecordingCatalog::Create(std::string record_path) {
+    auto ptr = std::make_shared<RecordingCatalog>(record_path);
+    ptr->Scan();
+    ptr->watch_worker_.reset(new Worker("Recording Catalog", [catalog = ptr.get()]() {
+        catalog->ReadEvents();
+    }));
+    ptr->watch_worker_->Run();
+    return ptr;
+}
+
+RecordingCatalog::RecordingCatalog(std::string record_path)
+    : record_path_(NormalizePath(record_path)),
+      total_bytes_(0),
+      inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+    if (inotify_fd_ < 0) {
+        ERROR_PRINT("inotify is not available, external changes won't be indexed.");
+    }
+}
+
+RecordingCatalog::~RecordingCatalog() {
+    watch_worker_.reset();
+    if (inotify_fd_ >= 0) {
+        close(inotify_fd_);
+    }
+}
+
+void RecordingCatalog::Scan() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        entries_.clear();
+        paths_.clear();
+        total_bytes_ = 0;
+    }
+    ScanFolder(record_path_, 0);
+    DEBUG_PRINT("Indexed %zu recordings (%ju bytes) in %s", size(), total_bytes(),
+                record_path_.c_str());
+}
+
+void RecordingCatalog::ScanFolder(const fs::path &folder, int depth) {
+    // watch first, so the files created while scanning are not missed.
+    WatchFolder(folder, depth);
+
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(folder, ec)) {
+        if (depth < kHourFolderDepth && entry.is_directory(ec)) {
+            ScanFolder(entry.path(), depth + 1);
+        } else if (depth == kHourFolderDepth && entry.path().extension() == ".mp4" &&
+                   entry.is_regular_file(ec)) {
+            Upsert(entry.path().string());
+        }
+    }
+}
+
+void RecordingCatalog::WatchFolder(const fs::path &folder, int depth) {
+    if (inotify_fd_ < 0 || depth > kHourFolderDepth) {
+        return;
+    }
+    int wd = inotify_add_watch(inotify_fd_, folder.c_str(), kWatchMask);
+    if (wd < 0) {
+        ERROR_PRINT("Failed to watch %s: %s", folder.c_str(), strerror(errno));
+        return;
+    }
+    watched_folders_[wd] = {folder, depth};
+}
+
+void RecordingCatalog::ReadEvents() {
+    if (inotify_fd_ < 0) {
+        usleep(kPollTimeoutMs * 1000);
+        return;
+    }
+
+    struct pollfd pfd = {inotify_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, kPollTimeoutMs) <= 0) {
+        return;
+    }
+
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + length;) {
+            auto *event = reinterpret_cast<struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                ERROR_PRINT("inotify queue overflowed, rescan %s", record_path_.c_str());
+                Scan();
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watched_folders_.erase(event->wd);
+                continue;
+            }
+
+            auto it = watched_folders_.find(event->wd);
+            if (it != watched_folders_.end() && event->len > 0) {
+                HandleEvent(it->second.first, it->second.second, event->mask, event->name);
+            }
+        }
+    }
+}
+
+void RecordingCatalog::HandleEvent(const fs::path &folder, int depth, uint32_t mask,
+                                   const std::string &name) {
+    auto path = folder / name;
+
+    if (mask & IN_ISDIR) {
+        if (mask & (IN_CREATE | IN_MOVED_TO) && depth < kHourFolderDepth) {
+            ScanFolder(path, depth + 1);
+        } else if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+            EraseFolder(path);
+        }
+        return;
+    }
+
+    if (depth != kHourFolderDepth) {
+        return;
+    }
+
+    bool is_added = mask & (IN_CLOSE_WRITE | IN_MOVED_TO);
+    bool is_removed = mask & (IN_DELETE | IN_MOVED_FROM);
+    if (path.extension() == ".mp4") {
+        if (is_added) {
+            Upsert(path.string());
+        } else if (is_removed) {
+            Remove(path.string());
+        }
+    } else if (path.extension() == ".jpg" && (is_added || is_removed)) {
+        SetThumbnail(path, is_added);
+    }
+}
+
+void RecordingCatalog::SetThumbnail(const fs::path &image_path, bool is_existing) {
+    auto key = NormalizePath(fs::path(image_path).replace_extension(".mp4"));
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(key);
+    if (it != paths_.end()) {
+        it->second->second.thumbnail_path = is_existing ? NormalizePath(image_path) : "";
+    }
+}
+
+void RecordingCatalog::Upsert(const std::string &path, int duration) {
+    auto entry = StatRecording(path);
+    if (!entry) {
+        Remove(path);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(entry->path);
+    if (duration >= 0) {
+        entry->duration = duration;
+    } else if (it != paths_.end() && it->second->second.duration >= 0) {
+        entry->duration = it->second->second.duration;
+    }
+    Insert(std::move(*entry));
+}
+
+void RecordingCatalog::Remove(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    Erase(NormalizePath(path));
+}
+
+bool RecordingCatalog::RemoveOldest() {
+    std::vector<RecordingEntry> oldest;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (entries_.empty()) {
+            return false;
+        }
+        oldest.push_back(entries_.begin()->second);
+    }
+    RemoveRecordings(oldest);
+    return true;
+}
+
+uintmax_t RecordingCatalog::RemoveRecordings(const std::vector<RecordingEntry> &entries) {
+    uintmax_t reclaimed = 0;
+    std::vector<std::string> files;
+    std::vector<fs::path> folders;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (const auto &entry : entries) {
+            Erase(entry.path);
+            reclaimed += entry.size;
+            fs::path path(entry.path);
+            files.push_back(entry.path);
+            files.push_back(fs::path(path).replace_extension(".jpg").string());
+            files.push_back(RecordingMetadata::SidecarPath(entry.path));
+            if (folders.empty() || folders.back() != path.parent_path()) {
+                folders.push_back(path.parent_path());
+            }
+        }
+    }
+    if (files.empty()) {
+        return 0;
+    }
+    Utils::RemoveFiles(files);
+    DEBUG_PRINT("Deleted %zu recordings from %s", entries.size(), entries.front().path.c_str());
+
+    // prune the hour folders and then the date folders if they're left empty.
+    std::error_code ec;
+    for (auto folder : folders) {
+        for (int depth = kHourFolderDepth; depth > 0; depth--) {
+            if (!fs::is_empty(folder, ec) || ec || !fs::remove(folder, ec)) {
+                break;
+            }
+            DEBUG_PRINT("Deleted the empty folder: %s", folder.c_str());
+            folder = folder.parent_path();
+        }
+    }
+    return reclaimed;
+}
+
+std::optional<RecordingEntry> RecordingCatalog::Latest() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (entries_.empty()) {
+        return std::nullopt;
+    }
+    return entries_.rbegin()->second;
+}
+
+std::optional<RecordingEntry>
+RecordingCatalog::FindBefore(std::chrono::system_clock::time_point time) {
+    auto file_time = fs::file_time_type::clock::from_sys(time);
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = entries_.lower_bound(file_time);
+    if (it == entries_.begin()) {
+        return std::nullopt;
+    }
+    return std::prev(it)->second;
+}
+
+std::vector<RecordingEntry> RecordingCatalog::FindOlder(const std::string &path, int num) {
+    std::vector<RecordingEntry> result;
+    std::lock_guard<std::mutex> lock(mtx_);
+
+    auto it = entries_.end();
+    if (!path.empty()) {
+        auto found = paths_.find(NormalizePath(path));
+        if (found != paths_.end()) {
+            it = entries_.lower_bound(found->second->first);
+        } else {
+            // e.g. the segment still being recorded, which is not indexed until it's closed.
+            std::error_code ec;
+            auto last_write_time = fs::last_write_time(path, ec);
+            if (ec) {
+                return result;
+            }
+            it = entries_.lower_bound(last_write_time);
+        }
+    }
+
+    while (it != entries_.begin() && result.size() < num) {
+        result.push_back((--it)->second);
+    }
+    return result;
+}
+
+std::vector<RecordingEntry> RecordingCatalog::FindBetween(fs::file_time_type after,
+                                                         fs::file_time_type until, int num) {
+    std::vector<RecordingEntry> result;
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto it = entries_.upper_bound(after); it != entries_.end() && it->first <= until;
+         ++it) {
+        // a later call starts after the last time, so the recordings of one time go together.
+        if (!result.empty() && result.size() >= num && it->first != std::prev(it)->first) {
+            break;
+        }
+        result.push_back(it->second);
+    }
+    return result;
+}
+
+std::string RecordingCatalog::ReadMetadata(const RecordingEntry &entry) {
+    auto metadata = RecordingMetadata::Load(entry.path);
+    if (metadata && (!metadata->image.empty() || entry.thumbnail_path.empty())) {
+        return metadata->ToString();
+    }
+
+    // either no sidecar yet, or the thumbnail was written after the segment was closed.
+    if (!metadata) {
+        metadata = RecordingMetadata::Probe(entry.path, entry.duration);
+    } else {
+        metadata->LoadImage(entry.thumbnail_path);
+    }
+    metadata->Save();
+    return metadata->ToString();
+}
+
+size_t RecordingCatalog::size() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return entries_.size();
+}
+
+uintmax_t RecordingCatalog::total_bytes() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return total_bytes_;
+}
+
+void RecordingCatalog::Insert(RecordingEntry entry) {
+    Erase(entry.path);
+    total_bytes_ += entry.size;
+    auto key = entry.path;
+    paths_[key] = entries_.emplace(entry.last_write_time, std::move(entry));
+}
+
+void RecordingCatalog::Erase(const std::string &path) {
+    auto it = paths_.find(path);
+    if (it == paths_.end()) {
+        return;
+    }
+    total_bytes_ -= it->second->second.size;
+    entries_.erase(it->second);
+    paths_.erase(it);
+}
+
+void RecordingCatalog::EraseFolder(const fs::path &folder) {
+    auto prefix = NormalizePath(folder) + "/";
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto it = paths_.begin(); it != paths_.end();) {
+        auto next = std::next(it);
+        if (it->first.compare(0, prefix.length(), prefix) == 0) {
+            Erase(it->first);
+        }
+        it = next;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef RECORDING_CATALOG_H_
+#define RECORDING_CATALOG_H_
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/worker.h"
+#include "recorder/recording_metadata.h"
+
+namespace fs = std::filesystem;
+
+struct RecordingEntry {
+    std::string path;
+    // empty until the preview image is written.
+    std::string thumbnail_path;
+    fs::file_time_type last_write_time;
+    uintmax_t size;
+    // in seconds, -1 if it's unknown.
+    int duration;
+};
+
+/* A time-sorted index of the recordings under `record_path/date/hour/`.
+ * It's built by one scan at startup, then kept up to date by the recorder and inotify,
+ * so the lookups never walk the folders again. */
+class RecordingCatalog {
+  public:
+    static std::shared_ptr<RecordingCatalog> Create(std::string record_path);
+
+    RecordingCatalog(std::string record_path);
+    ~RecordingCatalog();
+
+    // a negative duration keeps the known one, or estimates it from the filename.
+    void Upsert(const std::string &path, int duration = -1);
+    void Remove(const std::string &path);
+    // deletes the oldest recording with its files and the folders left empty.
+    bool RemoveOldest();
+    // deletes them in one batch like RemoveOldest(), returns the reclaimed bytes.
+    uintmax_t RemoveRecordings(const std::vector<RecordingEntry> &entries);
+
+    std::optional<RecordingEntry> Latest();
+    // the newest recording finished before the given time.
+    std::optional<RecordingEntry> FindBefore(std::chrono::system_clock::time_point time);
+    // the recordings older than the given one, newest first. An empty path starts from the
+    // latest recording inclusively.
+    std::vector<RecordingEntry> FindOlder(const std::string &path, int num);
+    // the recordings written in (after, until], oldest first. It may return a few more than
+    // `num` to finish the ones written at the same time as the last.
+    std::vector<RecordingEntry> FindBetween(fs::file_time_type after, fs::file_time_type until,
+                                            int num);
+
+    // the serialized metadata sidecar, it's created once for the older recordings.
+    std::string ReadMetadata(const RecordingEntry &entry);
+
+    size_t size();
+    uintmax_t total_bytes();
+
+  private:
+    using Index = std::multimap<fs::file_time_type, RecordingEntry>;
+
+    std::string record_path_;
+    std::mutex mtx_;
+    Index entries_;
+    std::unordered_map<std::string, Index::iterator> paths_;
+    uintmax_t total_bytes_;
+    int inotify_fd_;
+    // the watched folders with their depth, only touched by the watch worker once it runs.
+    std::unordered_map<int, std::pair<fs::path, int>> watched_folders_;
+    std::unique_ptr<Worker> watch_worker_;
+
+    void Scan();
+    void ScanFolder(const fs::path &folder, int depth);
+    void WatchFolder(const fs::path &folder, int depth);
+    void ReadEvents();
+    void HandleEvent(const fs::path &folder, int depth, uint32_t mask, const std::string &name);
+    void SetThumbnail(const fs::path &image_path, bool is_existing);
+    void Insert(RecordingEntry entry);
+    void Erase(const std::string &path);
+    void EraseFolder(const fs::path &folder);
+};
+
+#endif // RECORDING_CATALOG_H_
@@ -0,0 +1,98 @@
+#include "recorder/recording_metadata.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+
+#include "common/logging.h"
+#include "common/utils.h"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+std::string RecordingMetadata::SidecarPath(const std::string &path) {
+    return fs::path(path).replace_extension(".json").string();
+}
+
+std::optional<RecordingMetadata> RecordingMetadata::Load(const std::string &path) {
+    std::ifstream file(SidecarPath(path));
+    if (!file) {
+        return std::nullopt;
+    }
+
+    try {
+        json j = json::parse(file);
+        RecordingMetadata metadata;
+        metadata.path = path;
+        metadata.duration = j.value("duration", -1);
+        metadata.codec = j.value("codec", "");
+        metadata.width = j.value("width", 0);
+        metadata.height = j.value("height", 0);
+        metadata.size = j.value("size", (uintmax_t)0);
+        metadata.image = j.value("image", "");
+        return metadata;
+    } catch (const std::exception &e) {
+        ERROR_PRINT("Invalid metadata of %s: %s", path.c_str(), e.what());
+        return std::nullopt;
+    }
+}
+
+RecordingMetadata RecordingMetadata::Probe(const std::string &path, int duration) {
+    RecordingMetadata metadata;
+    metadata.path = path;
+    metadata.duration = duration >= 0 ? duration : Utils::GetVideoDuration(path);
+    std::error_code ec;
+    metadata.size = fs::file_size(path, ec);
+    metadata.LoadImage(fs::path(path).replace_extension(".jpg").string());
+    return metadata;
+}
+
+bool RecordingMetadata::LoadImage(const std::string &image_path) {
+    std::error_code ec;
+    if (image_path.empty() || !fs::exists(image_path, ec)) {
+        return false;
+    }
+    try {
+        auto binary_data = Utils::ReadFileInBinary(image_path);
+        image = "data:image/jpeg;base64," + Utils::ToBase64(binary_data);
+        return true;
+    } catch (const std::exception &e) {
+        ERROR_PRINT("Failed to read %s: %s", image_path.c_str(), e.what());
+        return false;
+    }
+}
+
+bool RecordingMetadata::Save() const {
+    // write aside and rename, so a reader never sees a half-written record.
+    auto sidecar_path = SidecarPath(path);
+    auto tmp_path = sidecar_path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file || !(file << ToString())) {
+            ERROR_PRINT("Failed to write %s", tmp_path.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tmp_path, sidecar_path, ec);
+    if (ec) {
+        ERROR_PRINT("Failed to write %s: %s", sidecar_path.c_str(), ec.message().c_str());
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+std::string RecordingMetadata::ToString() const {
+    json j;
+    j["path"] = path;
+    j["duration"] = duration;
+    j["codec"] = codec;
+    j["width"] = width;
+    j["height"] = height;
+    j["size"] = size;
+    j["image"] = image;
+    return j.dump();
+}
@@ -0,0 +1,32 @@
+#ifndef RECORDING_METADATA_H_
+#define RECORDING_METADATA_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/* The compact record written next to each segment when it's closed, e.g.
+ * `20240101_120000.json` beside `20240101_120000.mp4`. It's what the METADATA
+ * command sends, so a request never opens the mp4 or encodes the thumbnail again. */
+struct RecordingMetadata {
+    std::string path;
+    int duration = -1;
+    std::string codec;
+    int width = 0;
+    int height = 0;
+    uintmax_t size = 0;
+    // the thumbnail as a base64 data url.
+    std::string image;
+
+    static std::string SidecarPath(const std::string &path);
+    static std::optional<RecordingMetadata> Load(const std::string &path);
+    // for the recordings made before the sidecars existed, the mp4 is opened only if the
+    // duration is unknown.
+    static RecordingMetadata Probe(const std::string &path, int duration = -1);
+
+    bool LoadImage(const std::string &image_path);
+    bool Save() const;
+    std::string ToString() const;
+};
+
+#endif // RECORDING_METADATA_H_
@@ -0,0 +1,263 @@
+#include "recorder/retention_engine.h"
+
+#include <fstream>
+#include <sys/statvfs.h>
+
+#include "common/logging.h"
+#include "common/utils.h"
+#include "recorder/buffered_file_io.h"
+
+static const int kPassIntervalSec = 10;
+// the recordings deleted at once, a batch is unlinked by one submission.
+static const int kMaxBatchSize = 64;
+// a stripped recording is read and written again, so fewer of them are done per pass.
+static const int kMaxStripBatchSize = 4;
+static const int kSecondsPerSpan = 60;
+
+static uintmax_t GetFreeBytes(const std::string &path) {
+    struct statvfs stat;
+    if (statvfs(path.c_str(), &stat) != 0) {
+        // unknown, it's not a reason to delete anything.
+        return UINTMAX_MAX;
+    }
+    return (uintmax_t)stat.f_bsize * stat.f_bavail;
+}
+
+std::unique_ptr<RetentionEngine>
+RetentionEngine::Create(Args args, std::shared_ptr<RecordingCatalog> catalog) {
+    auto ptr = std::make_unique<RetentionEngine>(args, catalog);
+    ptr->worker_.reset(new Worker("Record Retention", [engine = ptr.get()]() {
+        {
+            std::unique_lock<std::mutex> lock(engine->mtx_);
+            if (engine->cond_.wait_for(lock, std::chrono::seconds(kPassIntervalSec),
+                                       [engine]() { return engine->is_stopped_; })) {
+                return;
+            }
+        }
+        engine->Enforce();
+    }));
+    ptr->worker_->Run();
+    return ptr;
+}
+
+RetentionEngine::RetentionEngine(Args args, std::shared_ptr<RecordingCatalog> catalog)
+    : record_path_(args.record_path),
+      catalog_(catalog),
+      max_age_(std::max(args.record_max_age_hours, 0)),
+      max_bytes_((uintmax_t)std::max(args.record_max_mb, 0) * 1024 * 1024),
+      min_free_bytes_((uintmax_t)std::max(args.record_min_free_mb, 0) * 1024 * 1024),
+      thin_after_(std::max(args.record_thin_after_hours, 0)),
+      thin_keep_one_of_(args.record_thin_keep_one_of),
+      is_thinning_keyframes_(args.record_thin_keyframes),
+      thin_cursor_(fs::file_time_type::min()),
+      last_kept_span_(-1),
+      reclaimed_bytes_(0),
+      is_stopped_(false) {
+    LoadCursor();
+    DEBUG_PRINT("Retention: max age %ld hours, max %ju MB, min free %ju MB, thin after %ld hours",
+                (long)max_age_.count(), max_bytes_ / 1024 / 1024, min_free_bytes_ / 1024 / 1024,
+                (long)thin_after_.count());
+}
+
+RetentionEngine::~RetentionEngine() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        is_stopped_ = true;
+    }
+    cond_.notify_all();
+    worker_.reset();
+}
+
+uintmax_t RetentionEngine::reclaimed_bytes() const { return reclaimed_bytes_.load(); }
+
+uintmax_t RetentionEngine::Enforce() {
+    uintmax_t by_age = EnforceMaxAge();
+    uintmax_t by_thinning = Thin();
+    uintmax_t by_space = EnforceSpace();
+
+    uintmax_t reclaimed = by_age + by_thinning + by_space;
+    if (reclaimed > 0) {
+        reclaimed_bytes_ += reclaimed;
+        DEBUG_PRINT("Retention reclaimed %ju bytes (age: %ju, thinning: %ju, space: %ju), %ju "
+                    "in total.",
+                    reclaimed, by_age, by_thinning, by_space, reclaimed_bytes_.load());
+    }
+    return reclaimed;
+}
+
+uintmax_t RetentionEngine::EnforceMaxAge() {
+    if (max_age_.count() <= 0) {
+        return 0;
+    }
+
+    auto cutoff = fs::file_time_type::clock::now() - max_age_;
+    uintmax_t reclaimed = 0;
+    std::vector<RecordingEntry> batch;
+    while (!(batch = catalog_->FindBetween(fs::file_time_type::min(), cutoff, kMaxBatchSize))
+                .empty()) {
+        reclaimed += catalog_->RemoveRecordings(batch);
+    }
+    return reclaimed;
+}
+
+uintmax_t RetentionEngine::EnforceSpace() {
+    uintmax_t excess = 0;
+    uintmax_t total_bytes = catalog_->total_bytes();
+    if (max_bytes_ > 0 && total_bytes > max_bytes_) {
+        excess = total_bytes - max_bytes_;
+    }
+    uintmax_t free_bytes = GetFreeBytes(record_path_);
+    if (free_bytes < min_free_bytes_) {
+        excess = std::max(excess, min_free_bytes_ - free_bytes);
+    }
+    if (excess == 0) {
+        return 0;
+    }
+
+    auto oldest =
+        catalog_->FindBetween(fs::file_time_type::min(), fs::file_time_type::max(), kMaxBatchSize);
+    if (oldest.empty()) {
+        // nothing is indexed, e.g. only the segment being recorded is left.
+        Utils::RotateFiles(record_path_);
+        return 0;
+    }
+
+    // the freed space may show up in statvfs a bit later, so one batch per pass that's just
+    // enough by the sizes, and the next pass checks again.
+    std::vector<RecordingEntry> batch;
+    uintmax_t batch_bytes = 0;
+    for (auto &entry : oldest) {
+        if (batch_bytes >= excess) {
+            break;
+        }
+        batch_bytes += entry.size;
+        batch.push_back(std::move(entry));
+    }
+    return catalog_->RemoveRecordings(batch);
+}
+
+uintmax_t RetentionEngine::Thin() {
+    if (thin_after_.count() <= 0 || (!is_thinning_keyframes_ && thin_keep_one_of_ <= 1)) {
+        return 0;
+    }
+
+    auto cutoff = fs::file_time_type::clock::now() - thin_after_;
+    auto batch = catalog_->FindBetween(thin_cursor_, cutoff,
+                                       is_thinning_keyframes_ ? kMaxStripBatchSize : kMaxBatchSize);
+    if (batch.empty()) {
+        return 0;
+    }
+
+    uintmax_t reclaimed = 0;
+    std::vector<RecordingEntry> dropped;
+    for (const auto &entry : batch) {
+        if (is_thinning_keyframes_) {
+            std::error_code ec;
+            if (StripToKeyframes(entry)) {
+                auto size = fs::file_size(entry.path, ec);
+                reclaimed += !ec && size < entry.size ? entry.size - size : 0;
+            }
+            continue;
+        }
+
+        // the first recording of each span is kept, so thinning it again keeps the same one.
+        auto end_time = fs::file_time_type::clock::to_sys(entry.last_write_time);
+        int64_t span = std::chrono::duration_cast<std::chrono::seconds>(
+                           end_time.time_since_epoch())
+                           .count() /
+                       (kSecondsPerSpan * thin_keep_one_of_);
+        if (span == last_kept_span_) {
+            dropped.push_back(entry);
+        } else {
+            last_kept_span_ = span;
+        }
+    }
+    thin_cursor_ = batch.back().last_write_time;
+    SaveCursor();
+
+    return reclaimed + catalog_->RemoveRecordings(dropped);
+}
+
+bool RetentionEngine::StripToKeyframes(const RecordingEntry &entry) {
+    AVFormatContext *in_ctx = nullptr;
+    if (avformat_open_input(&in_ctx, entry.path.c_str(), nullptr, nullptr) < 0) {
+        return false;
+    }
+    int video_index = -1;
+    if (avformat_find_stream_info(in_ctx, nullptr) >= 0) {
+        video_index = av_find_best_stream(in_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    }
+
+    // not an mp4, so the catalog doesn't pick it up while it's written.
+    auto temp_path = entry.path + ".thin";
+    AVFormatContext *out_ctx = nullptr;
+    bool is_done = false;
+    if (video_index >= 0 &&
+        avformat_alloc_output_context2(&out_ctx, nullptr, "mp4", temp_path.c_str()) >= 0 &&
+        (out_ctx->pb = BufferedFileIO::Open(temp_path))) {
+        out_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+        auto *in_st = in_ctx->streams[video_index];
+        auto *out_st = avformat_new_stream(out_ctx, nullptr);
+        avcodec_parameters_copy(out_st->codecpar, in_st->codecpar);
+        out_st->codecpar->codec_tag = 0;
+        out_st->time_base = in_st->time_base;
+
+        if (avformat_write_header(out_ctx, nullptr) >= 0) {
+            int keyframes = 0;
+            AVPacket *pkt = av_packet_alloc();
+            while (av_read_frame(in_ctx, pkt) >= 0) {
+                if (pkt->stream_index == video_index && (pkt->flags & AV_PKT_FLAG_KEY)) {
+                    // each keyframe lasts until the next one, so the timeline stays the same.
+                    pkt->stream_index = out_st->index;
+                    pkt->pos = -1;
+                    av_packet_rescale_ts(pkt, in_st->time_base, out_st->time_base);
+                    keyframes += av_interleaved_write_frame(out_ctx, pkt) >= 0;
+                }
+                av_packet_unref(pkt);
+            }
+            av_packet_free(&pkt);
+            is_done = av_write_trailer(out_ctx) >= 0 && keyframes > 0;
+        }
+        BufferedFileIO::Close(&out_ctx->pb);
+    }
+    avformat_free_context(out_ctx);
+    avformat_close_input(&in_ctx);
+
+    std::error_code ec;
+    if (is_done) {
+        // keeps its place in the catalog, which is sorted by the modified time.
+        fs::last_write_time(temp_path, entry.last_write_time, ec);
+        fs::rename(temp_path, entry.path, ec);
+        is_done = !ec;
+    }
+    if (!is_done) {
+        fs::remove(temp_path, ec);
+        ERROR_PRINT("Could not thin out %s", entry.path.c_str());
+        return false;
+    }
+    // the sidecar is made again with the new size.
+    fs::remove(RecordingMetadata::SidecarPath(entry.path), ec);
+    return true;
+}
+
+std::string RetentionEngine::CursorPath() const {
+    return (fs::path(record_path_) / ".retention").string();
+}
+
+void RetentionEngine::LoadCursor() {
+    std::ifstream file(CursorPath());
+    int64_t count;
+    int64_t span;
+    if (file >> count) {
+        thin_cursor_ = fs::file_time_type(fs::file_time_type::duration(count));
+    }
+    // the older files only have the cursor.
+    if (file >> span) {
+        last_kept_span_ = span;
+    }
+}
+
+void RetentionEngine::SaveCursor() {
+    std::ofstream file(CursorPath(), std::ios::trunc);
+    file << (int64_t)thin_cursor_.time_since_epoch().count() << " " << last_kept_span_;
+}
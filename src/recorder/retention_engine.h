@@ -0,0 +1,61 @@
+#ifndef RETENTION_ENGINE_H_
+#define RETENTION_ENGINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "args.h"
+#include "common/worker.h"
+#include "recorder/recording_catalog.h"
+
+/* Deletes and thins out the recordings by the `record_*` retention args. It works on the
+ * time-sorted catalog, so a pass only looks at the oldest recordings, or at the ones past
+ * where the last thinning stopped, and never walks the folders. */
+class RetentionEngine {
+  public:
+    static std::unique_ptr<RetentionEngine> Create(Args args,
+                                                   std::shared_ptr<RecordingCatalog> catalog);
+
+    RetentionEngine(Args args, std::shared_ptr<RecordingCatalog> catalog);
+    ~RetentionEngine();
+
+    // runs every policy once, returns the reclaimed bytes.
+    uintmax_t Enforce();
+    // the bytes reclaimed since it's created.
+    uintmax_t reclaimed_bytes() const;
+
+  private:
+    std::string record_path_;
+    std::shared_ptr<RecordingCatalog> catalog_;
+    std::chrono::hours max_age_;
+    uintmax_t max_bytes_;
+    uintmax_t min_free_bytes_;
+    std::chrono::hours thin_after_;
+    int thin_keep_one_of_;
+    bool is_thinning_keyframes_;
+    // the recordings up to here are thinned, it's kept in a file across restarts along with
+    // the span of the last kept one.
+    fs::file_time_type thin_cursor_;
+    int64_t last_kept_span_;
+    std::atomic<uintmax_t> reclaimed_bytes_;
+    // the passes are waited out on it, so the destructor doesn't wait for the next one.
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool is_stopped_;
+    std::unique_ptr<Worker> worker_;
+
+    uintmax_t EnforceMaxAge();
+    uintmax_t EnforceSpace();
+    uintmax_t Thin();
+    // rewrites the recording with only its video keyframes, at the same modified time.
+    static bool StripToKeyframes(const RecordingEntry &entry);
+    std::string CursorPath() const;
+    void LoadCursor();
+    void SaveCursor();
+};
+
+#endif // RETENTION_ENGINE_H_
@@ -26,14 +26,25 @@ void VideoRecorder::InitializeEncoderCtx(AVCodecContext *&encoder) {
 }
 
 void VideoRecorder::OnBuffer(V4l2Buffer &buffer) {
-    if (frame_buffer_queue.size() < 8) {
-        rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer(
-            V4l2FrameBuffer::Create(config.width, config.height, buffer, config.format));
+    OnFrameBuffer(V4l2FrameBuffer::Create(config.width, config.height, buffer, config.format));
+}
+
+void VideoRecorder::OnFrameBuffer(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
+    if (frame_buffer_queue.size() >= 8) {
+        DropFrame();
+        return;
+    }
+
+    // hold the leased camera buffer until it is encoded, copy only if none is left to lend.
+    if (!frame_buffer->GetRawBuffer().lease) {
         frame_buffer->CopyBufferData();
-        frame_buffer_queue.push(frame_buffer);
     }
+    frame_buffer_queue.push(frame_buffer);
+    NotifyBuffer();
 }
 
+size_t VideoRecorder::queue_depth() { return frame_buffer_queue.size(); }
+
 void VideoRecorder::PostStop() {
     has_first_keyframe = false;
 }
@@ -46,10 +57,14 @@ void VideoRecorder::OnEncoded(V4l2Buffer &buffer) {
     pkt.data = static_cast<uint8_t *>(buffer.start);
     pkt.size = buffer.length;
     pkt.stream_index = st->index;
+    if (buffer.flags & V4L2_BUF_FLAG_KEYFRAME) {
+        pkt.flags |= AV_PKT_FLAG_KEY;
+    }
 
     double elapsed_time = (buffer.timestamp.tv_sec - base_time_.tv_sec) +
                           (buffer.timestamp.tv_usec - base_time_.tv_usec) / 1000000.0;
-    pkt.pts = pkt.dts = static_cast<int>(elapsed_time * st->time_base.den / st->time_base.num);
+    pkt.pts = pkt.dts =
+        static_cast<int64_t>(elapsed_time * st->time_base.den / st->time_base.num);
 
     OnPacketed(&pkt);
     av_packet_unref(&pkt);
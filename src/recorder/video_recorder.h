@@ -69,7 +69,11 @@ class VideoRecorder : public Recorder<V4l2Buffer> {
     VideoRecorder(Args config, std::string encoder_name);
     virtual ~VideoRecorder(){};
     void OnBuffer(V4l2Buffer &buffer) override;
+    void OnFrameBuffer(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer);
     void PostStop() override;
+    size_t queue_depth() override;
+    // the next encoded frame is a keyframe, if the recorder runs its own encoder.
+    virtual void RequestKeyFrame(){};
 
   protected:
     Args config;
@@ -1,5 +1,6 @@
 #include "rtc_peer.h"
 
+#include <charconv>
 #include <chrono>
 #include <iostream>
 #include <regex>
@@ -58,6 +59,10 @@ void RtcPeer::SetPeer(rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer)
 
 rtc::scoped_refptr<webrtc::PeerConnectionInterface> RtcPeer::GetPeer() { return peer_connection_; }
 
+std::shared_ptr<DataChannelSubject> RtcPeer::GetDataChannel() const {
+    return data_channel_subject_;
+}
+
 void RtcPeer::CreateDataChannel() {
     struct webrtc::DataChannelInit init;
     init.ordered = true;
@@ -105,6 +110,8 @@ void RtcPeer::OnMetadata(OnCommand func) { SubscribeCommandChannel(CommandType::
 
 void RtcPeer::OnRecord(OnCommand func) { SubscribeCommandChannel(CommandType::RECORD, func); }
 
+void RtcPeer::OnTrigger(OnCommand func) { SubscribeCommandChannel(CommandType::TRIGGER, func); }
+
 void RtcPeer::SubscribeCommandChannel(CommandType type, OnCommand func) {
     auto observer = data_channel_subject_->AsObservable(type);
     observer->Subscribe([this, func](std::string message) {
@@ -235,6 +242,24 @@ void RtcPeer::OnFailure(webrtc::RTCError error) {
     ERROR_PRINT("%s; %s", std::string(type).c_str(), error.message());
 }
 
+size_t RtcPeer::ParseMaxMessageSize(const std::string &sdp) {
+    // RFC 8841, it's 64 KB if the attribute is absent.
+    // the value is clamped by the subject, a malformed or overflowing one is taken as absent.
+    const size_t default_size = 65536;
+    std::smatch match;
+    if (!std::regex_search(sdp, match, std::regex(R"(a=max-message-size:(\d+))"))) {
+        return default_size;
+    }
+    size_t size = 0;
+    auto str = match[1].str();
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), size);
+    if (ec != std::errc() || ptr != str.data() + str.size()) {
+        ERROR_PRINT("Invalid max-message-size: %s", str.c_str());
+        return default_size;
+    }
+    return size;
+}
+
 void RtcPeer::SetRemoteSdp(const std::string &sdp, const std::string &sdp_type) {
     if (is_connected_.load()) {
         return;
@@ -256,6 +281,10 @@ void RtcPeer::SetRemoteSdp(const std::string &sdp, const std::string &sdp_type)
         return;
     }
 
+    if (data_channel_subject_) {
+        data_channel_subject_->SetMaxMessageSize(ParseMaxMessageSize(sdp));
+    }
+
     peer_connection_->SetRemoteDescription(SetSessionDescription::Create(nullptr, nullptr).get(),
                                            session_description.release());
 
@@ -87,11 +87,13 @@ class RtcPeer : public webrtc::PeerConnectionObserver,
     void SetSink(rtc::VideoSinkInterface<webrtc::VideoFrame> *video_sink_obj);
     void SetPeer(rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer);
     rtc::scoped_refptr<webrtc::PeerConnectionInterface> GetPeer();
+    std::shared_ptr<DataChannelSubject> GetDataChannel() const;
     void CreateDataChannel();
     std::string RestartIce(std::string ice_ufrag, std::string ice_pwd);
     void OnSnapshot(OnCommand func);
     void OnMetadata(OnCommand func);
     void OnRecord(OnCommand func);
+    void OnTrigger(OnCommand func);
 
     // SignalingMessageObserver implementation.
     void SetRemoteSdp(const std::string &sdp, const std::string &type) override;
@@ -116,6 +118,7 @@ class RtcPeer : public webrtc::PeerConnectionObserver,
     void OnFailure(webrtc::RTCError error) override;
 
     std::string ModifySetupAttribute(const std::string &sdp, const std::string &new_setup);
+    size_t ParseMaxMessageSize(const std::string &sdp);
     void EmitLocalSdp(int delay_sec = 0);
 
     std::string id_;
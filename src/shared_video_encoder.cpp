@@ -0,0 +1,482 @@
+#include "shared_video_encoder.h"
+
+#include <algorithm>
+
+#include "common/logging.h"
+
+static const size_t kMaxPendingFrames = 8;
+static const size_t kMaxEncodedFrames = 4;
+static const int kWaitTimeoutMs = 500;
+static const int kKeyFrameIntervalSec = 4;
+static const int kDefaultQpMax = 51;
+
+std::shared_ptr<VideoEncoderHub> VideoEncoderHub::Create(EncoderCreator creator) {
+    return std::make_shared<VideoEncoderHub>(std::move(creator));
+}
+
+VideoEncoderHub::VideoEncoderHub(EncoderCreator creator)
+    : is_initialized_(false),
+      pending_key_frame_(true),
+      encoder_(creator()),
+      always_on_fps_(0) {
+    encoder_->RegisterEncodeCompleteCallback(this);
+}
+
+VideoEncoderHub::~VideoEncoderHub() {
+    worker_.reset();
+    std::lock_guard<std::mutex> lock(encoder_mtx_);
+    encoder_->Release();
+}
+
+void VideoEncoderHub::StartAlwaysOn(int fps) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (always_on_fps_ > 0) {
+            return;
+        }
+        always_on_fps_ = std::max(fps, 1);
+    }
+    worker_.reset(new Worker("EncoderHub", [this]() {
+        EncodeNextFrame();
+    }));
+    worker_->Run();
+}
+
+void VideoEncoderHub::OnFrame(const webrtc::VideoFrame &frame) {
+    // never encode on the capturing thread, the software encoder would hold it up.
+    {
+        std::lock_guard<std::mutex> lock(frame_mtx_);
+        next_frame_ = frame;
+    }
+    frame_cond_.notify_one();
+}
+
+std::shared_ptr<Observable<V4l2Buffer>> VideoEncoderHub::AsEncodedObservable() {
+    std::lock_guard<std::mutex> lock(tap_mtx_);
+    return encoded_subject_.AsObservable();
+}
+
+void VideoEncoderHub::RequestKeyFrame() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    pending_key_frame_ = true;
+}
+
+void VideoEncoderHub::EncodeNextFrame() {
+    std::optional<webrtc::VideoFrame> frame;
+    {
+        std::unique_lock<std::mutex> lock(frame_mtx_);
+        if (!frame_cond_.wait_for(lock, std::chrono::milliseconds(kWaitTimeoutMs),
+                                  [this]() { return next_frame_.has_value(); })) {
+            return;
+        }
+        frame.swap(next_frame_);
+    }
+
+    if (!InitAlwaysOn(frame->width(), frame->height())) {
+        return;
+    }
+    // stamped like webrtc does, so the result can be matched. the peers submitting the same
+    // frame get the result of this encoding.
+    frame->set_timestamp(static_cast<uint32_t>(frame->timestamp_us() * 90 / 1000));
+    Encode(nullptr, *frame, nullptr);
+}
+
+bool VideoEncoderHub::InitAlwaysOn(int width, int height) {
+    std::lock_guard<std::mutex> encoder_lock(encoder_mtx_);
+    if (is_initialized_) {
+        // a peer has initialized it, or it was done by an earlier frame.
+        return true;
+    }
+
+    int fps = always_on_fps_;
+    uint32_t bitrate_kbps = width * height * fps * 0.1 / 1000;
+
+    webrtc::VideoCodec codec;
+    codec.codecType = webrtc::kVideoCodecH264;
+    codec.width = width;
+    codec.height = height;
+    codec.maxFramerate = fps;
+    codec.startBitrate = bitrate_kbps;
+    codec.maxBitrate = bitrate_kbps;
+    codec.minBitrate = bitrate_kbps / 4;
+    codec.qpMax = kDefaultQpMax;
+    codec.mode = webrtc::VideoCodecMode::kRealtimeVideo;
+    codec.numberOfSimulcastStreams = 1;
+    codec.simulcastStream[0].width = width;
+    codec.simulcastStream[0].height = height;
+    codec.simulcastStream[0].maxFramerate = fps;
+    codec.simulcastStream[0].numberOfTemporalLayers = 1;
+    codec.simulcastStream[0].maxBitrate = codec.maxBitrate;
+    codec.simulcastStream[0].targetBitrate = codec.startBitrate;
+    codec.simulcastStream[0].minBitrate = codec.minBitrate;
+    codec.simulcastStream[0].qpMax = kDefaultQpMax;
+    codec.simulcastStream[0].active = true;
+    codec.H264()->keyFrameInterval = fps * kKeyFrameIntervalSec;
+    codec.H264()->numberOfTemporalLayers = 1;
+
+    webrtc::VideoEncoder::Settings settings(webrtc::VideoEncoder::Capabilities(false), 1, 0);
+    int32_t ret = encoder_->InitEncode(&codec, settings);
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        ERROR_PRINT("Failed to initialize the always-on encoder => %d", ret);
+        return false;
+    }
+    DEBUG_PRINT("The shared encoder keeps running at %dx%d@%d, %u kbps.", width, height, fps,
+                bitrate_kbps);
+
+    codec_ = codec;
+    is_initialized_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending_key_frame_ = true;
+    }
+    ApplyRates();
+
+    return true;
+}
+
+void VideoEncoderHub::Subscribe(SharedVideoEncoder *subscriber,
+                                webrtc::EncodedImageCallback *callback) {
+    std::lock_guard<std::mutex> callback_lock(callback_mtx_);
+    std::lock_guard<std::mutex> lock(mtx_);
+    subscribers_[subscriber].callback = callback;
+}
+
+void VideoEncoderHub::UnSubscribe(SharedVideoEncoder *subscriber) {
+    {
+        std::lock_guard<std::mutex> callback_lock(callback_mtx_);
+        std::lock_guard<std::mutex> lock(mtx_);
+        subscribers_.erase(subscriber);
+        for (auto &pending : pending_frames_) {
+            pending.receivers.erase(subscriber);
+        }
+    }
+    Release(nullptr);
+}
+
+int32_t VideoEncoderHub::InitEncode(SharedVideoEncoder *subscriber,
+                                    const webrtc::VideoCodec *codec_settings,
+                                    const webrtc::VideoEncoder::Settings &settings) {
+    std::lock_guard<std::mutex> encoder_lock(encoder_mtx_);
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        subscribers_[subscriber].is_active = true;
+        pending_key_frame_ = true;
+    }
+
+    if (is_initialized_ && codec_.codecType == codec_settings->codecType &&
+        codec_.width == codec_settings->width && codec_.height == codec_settings->height) {
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    if (is_initialized_) {
+        DEBUG_PRINT("Reinitialize the shared encoder: %dx%d -> %dx%d", codec_.width, codec_.height,
+                    codec_settings->width, codec_settings->height);
+        encoder_->Release();
+        is_initialized_ = false;
+    }
+
+    int32_t ret = encoder_->InitEncode(codec_settings, settings);
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        ERROR_PRINT("Failed to initialize the shared encoder => %d", ret);
+        return ret;
+    }
+
+    codec_ = *codec_settings;
+    is_initialized_ = true;
+    ApplyRates();
+
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t VideoEncoderHub::Release(SharedVideoEncoder *subscriber) {
+    std::lock_guard<std::mutex> encoder_lock(encoder_mtx_);
+    bool is_always_on;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (subscriber && subscribers_.count(subscriber)) {
+            subscribers_[subscriber].is_active = false;
+            subscribers_[subscriber].rates.reset();
+        }
+
+        bool has_active = std::any_of(subscribers_.begin(), subscribers_.end(),
+                                      [](const auto &pair) { return pair.second.is_active; });
+        if (has_active) {
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+        is_always_on = always_on_fps_ > 0;
+        if (!is_always_on) {
+            pending_frames_.clear();
+            encoded_frames_.clear();
+        }
+    }
+
+    if (is_always_on) {
+        // it keeps running for the encoded observers, back at its own rates.
+        ApplyRates();
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    if (is_initialized_) {
+        DEBUG_PRINT("Release the shared encoder, no more active subscribers.");
+        encoder_->Release();
+        is_initialized_ = false;
+    }
+
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t VideoEncoderHub::Encode(SharedVideoEncoder *subscriber, const webrtc::VideoFrame &frame,
+                                const std::vector<webrtc::VideoFrameType> *frame_types) {
+    bool is_key_requested = false;
+    if (frame_types) {
+        if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+        is_key_requested = (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+    }
+
+    FrameMeta meta = {frame.timestamp(), frame.ntp_time_ms(), frame.render_time_ms(),
+                      frame.rotation()};
+    std::optional<EncodedFrame> encoded;
+    bool need_encode = false;
+    bool is_key_frame = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        // coalesce the key frame requests from all peers into the next encoded frame.
+        pending_key_frame_ |= is_key_requested;
+
+        auto encoded_it = std::find_if(
+            encoded_frames_.begin(), encoded_frames_.end(),
+            [&frame](const EncodedFrame &e) { return e.timestamp_us == frame.timestamp_us(); });
+        auto pending_it = std::find_if(
+            pending_frames_.begin(), pending_frames_.end(),
+            [&frame](const PendingFrame &p) { return p.timestamp_us == frame.timestamp_us(); });
+
+        if (encoded_it != encoded_frames_.end()) {
+            encoded = *encoded_it;
+        } else if (pending_it != pending_frames_.end()) {
+            if (subscriber) {
+                pending_it->receivers[subscriber] = meta;
+            }
+        } else {
+            // the always-on encoding has no receiver, its result is only published.
+            PendingFrame pending = {frame.timestamp(), frame.timestamp_us(), {}};
+            if (subscriber) {
+                pending.receivers[subscriber] = meta;
+            }
+            pending_frames_.push_back(std::move(pending));
+            if (pending_frames_.size() > kMaxPendingFrames) {
+                pending_frames_.pop_front();
+            }
+            is_key_frame = pending_key_frame_;
+            pending_key_frame_ = false;
+            need_encode = true;
+        }
+    }
+
+    if (encoded && subscriber) {
+        std::lock_guard<std::mutex> callback_lock(callback_mtx_);
+        Deliver(subscriber, encoded->image, &encoded->codec_specific, meta);
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    if (encoded || !need_encode) {
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    std::vector<webrtc::VideoFrameType> types = {is_key_frame
+                                                     ? webrtc::VideoFrameType::kVideoFrameKey
+                                                     : webrtc::VideoFrameType::kVideoFrameDelta};
+
+    std::lock_guard<std::mutex> encoder_lock(encoder_mtx_);
+    int32_t ret =
+        is_initialized_ ? encoder_->Encode(frame, &types) : WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending_key_frame_ |= is_key_frame;
+        pending_frames_.erase(
+            std::remove_if(pending_frames_.begin(), pending_frames_.end(),
+                           [&frame](const PendingFrame &p) {
+                               return p.timestamp_us == frame.timestamp_us();
+                           }),
+            pending_frames_.end());
+    }
+
+    return ret;
+}
+
+void VideoEncoderHub::SetRates(SharedVideoEncoder *subscriber,
+                               const webrtc::VideoEncoder::RateControlParameters &parameters) {
+    std::lock_guard<std::mutex> encoder_lock(encoder_mtx_);
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        subscribers_[subscriber].rates = parameters;
+    }
+    ApplyRates();
+}
+
+webrtc::VideoEncoder::EncoderInfo VideoEncoderHub::GetEncoderInfo() const {
+    auto info = encoder_->GetEncoderInfo();
+    info.implementation_name += " (shared)";
+    return info;
+}
+
+void VideoEncoderHub::ApplyRates() {
+    if (!is_initialized_) {
+        return;
+    }
+
+    // the slowest peer decides the bitrate, while the fastest one decides the frame rate.
+    std::optional<webrtc::VideoEncoder::RateControlParameters> rates;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        double max_fps = 0;
+        for (auto &[_, sub] : subscribers_) {
+            if (!sub.is_active || !sub.rates) {
+                continue;
+            }
+            if (!rates || sub.rates->bitrate.get_sum_bps() < rates->bitrate.get_sum_bps()) {
+                rates = sub.rates;
+            }
+            max_fps = std::max(max_fps, sub.rates->framerate_fps);
+        }
+        if (rates) {
+            rates->framerate_fps = max_fps;
+        } else if (always_on_fps_ > 0) {
+            // no peer is connected, keep the bitrate it was initialized with.
+            webrtc::VideoBitrateAllocation allocation;
+            allocation.SetBitrate(0, 0, codec_.startBitrate * 1000);
+            rates = webrtc::VideoEncoder::RateControlParameters(allocation, always_on_fps_);
+        }
+    }
+
+    if (rates) {
+        encoder_->SetRates(*rates);
+    }
+}
+
+webrtc::EncodedImageCallback::Result
+VideoEncoderHub::OnEncodedImage(const webrtc::EncodedImage &encoded_image,
+                                const webrtc::CodecSpecificInfo *codec_specific_info) {
+    std::map<SharedVideoEncoder *, FrameMeta> receivers;
+    int64_t timestamp_us;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = std::find_if(pending_frames_.begin(), pending_frames_.end(),
+                               [&encoded_image](const PendingFrame &p) {
+                                   return p.rtp_timestamp == encoded_image.Timestamp();
+                               });
+        if (it == pending_frames_.end()) {
+            return Result(Result::OK);
+        }
+
+        EncodedFrame encoded = {it->timestamp_us, encoded_image, webrtc::CodecSpecificInfo()};
+        if (codec_specific_info) {
+            encoded.codec_specific = *codec_specific_info;
+        }
+        encoded_frames_.push_back(std::move(encoded));
+        if (encoded_frames_.size() > kMaxEncodedFrames) {
+            encoded_frames_.pop_front();
+        }
+
+        timestamp_us = it->timestamp_us;
+        receivers = std::move(it->receivers);
+        pending_frames_.erase(it);
+    }
+
+    {
+        std::lock_guard<std::mutex> callback_lock(callback_mtx_);
+        for (auto &[subscriber, meta] : receivers) {
+            Deliver(subscriber, encoded_image, codec_specific_info, meta);
+        }
+    }
+    Publish(encoded_image, timestamp_us);
+
+    return Result(Result::OK);
+}
+
+void VideoEncoderHub::Publish(const webrtc::EncodedImage &encoded_image, int64_t timestamp_us) {
+    auto encoded_data = encoded_image.GetEncodedData();
+    if (!encoded_data) {
+        return;
+    }
+
+    struct timeval timestamp = {static_cast<time_t>(timestamp_us / 1000000),
+                                static_cast<suseconds_t>(timestamp_us % 1000000)};
+    unsigned int flags = encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey
+                             ? V4L2_BUF_FLAG_KEYFRAME
+                             : 0;
+    V4l2Buffer buffer(encoded_data->data(), encoded_data->size(), flags, timestamp);
+    // the encoded data is refcounted, the observers keep it instead of copying.
+    buffer.lease =
+        std::make_shared<rtc::scoped_refptr<webrtc::EncodedImageBufferInterface>>(encoded_data);
+
+    std::lock_guard<std::mutex> lock(tap_mtx_);
+    encoded_subject_.Next(buffer);
+}
+
+void VideoEncoderHub::Deliver(SharedVideoEncoder *subscriber,
+                              const webrtc::EncodedImage &encoded_image,
+                              const webrtc::CodecSpecificInfo *codec_specific_info,
+                              const FrameMeta &meta) {
+    webrtc::EncodedImageCallback *callback = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = subscribers_.find(subscriber);
+        if (it == subscribers_.end() || !it->second.is_active) {
+            return;
+        }
+        callback = it->second.callback;
+    }
+    if (!callback) {
+        return;
+    }
+
+    // the bitstream is shared, only the per-peer timing info is rewritten.
+    webrtc::EncodedImage image = encoded_image;
+    image.SetTimestamp(meta.rtp_timestamp);
+    image.ntp_time_ms_ = meta.ntp_time_ms;
+    image.capture_time_ms_ = meta.render_time_ms;
+    image.rotation_ = meta.rotation;
+
+    auto result = callback->OnEncodedImage(image, codec_specific_info);
+    if (result.error != webrtc::EncodedImageCallback::Result::OK) {
+        ERROR_PRINT("Failed to send the shared frame => %d", result.error);
+    }
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+SharedVideoEncoder::Create(std::shared_ptr<VideoEncoderHub> hub) {
+    return std::make_unique<SharedVideoEncoder>(hub);
+}
+
+SharedVideoEncoder::SharedVideoEncoder(std::shared_ptr<VideoEncoderHub> hub)
+    : hub_(hub) {}
+
+SharedVideoEncoder::~SharedVideoEncoder() { hub_->UnSubscribe(this); }
+
+int32_t SharedVideoEncoder::InitEncode(const webrtc::VideoCodec *codec_settings,
+                                       const VideoEncoder::Settings &settings) {
+    return hub_->InitEncode(this, codec_settings, settings);
+}
+
+int32_t SharedVideoEncoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback *callback) {
+    hub_->Subscribe(this, callback);
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t SharedVideoEncoder::Release() { return hub_->Release(this); }
+
+int32_t SharedVideoEncoder::Encode(const webrtc::VideoFrame &frame,
+                                   const std::vector<webrtc::VideoFrameType> *frame_types) {
+    return hub_->Encode(this, frame, frame_types);
+}
+
+void SharedVideoEncoder::SetRates(const RateControlParameters &parameters) {
+    hub_->SetRates(this, parameters);
+}
+
+webrtc::VideoEncoder::EncoderInfo SharedVideoEncoder::GetEncoderInfo() const {
+    return hub_->GetEncoderInfo();
+}
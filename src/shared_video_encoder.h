@@ -0,0 +1,138 @@
+#ifndef SHARED_VIDEO_ENCODER_H_
+#define SHARED_VIDEO_ENCODER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <api/video/video_sink_interface.h>
+#include <api/video_codecs/video_encoder.h>
+
+#include "common/interface/encoded_video_source.h"
+#include "common/worker.h"
+
+class SharedVideoEncoder;
+
+/* Owns the only real encoder instance. Every frame is encoded once and the
+ * bitstream is fanned out to all the peers which submitted the same frame.
+ * Once started as a sink of the track, it keeps encoding without any peer,
+ * and the bitstream is also published to the encoded observers. */
+class VideoEncoderHub : public webrtc::EncodedImageCallback,
+                        public rtc::VideoSinkInterface<webrtc::VideoFrame>,
+                        public EncodedVideoSource {
+  public:
+    using EncoderCreator = std::function<std::unique_ptr<webrtc::VideoEncoder>()>;
+
+    static std::shared_ptr<VideoEncoderHub> Create(EncoderCreator creator);
+
+    VideoEncoderHub(EncoderCreator creator);
+    ~VideoEncoderHub();
+
+    // the frames from OnFrame() are encoded at the given frame rate until destroyed.
+    void StartAlwaysOn(int fps);
+
+    void Subscribe(SharedVideoEncoder *subscriber, webrtc::EncodedImageCallback *callback);
+    void UnSubscribe(SharedVideoEncoder *subscriber);
+    int32_t InitEncode(SharedVideoEncoder *subscriber, const webrtc::VideoCodec *codec_settings,
+                       const webrtc::VideoEncoder::Settings &settings);
+    int32_t Release(SharedVideoEncoder *subscriber);
+    int32_t Encode(SharedVideoEncoder *subscriber, const webrtc::VideoFrame &frame,
+                   const std::vector<webrtc::VideoFrameType> *frame_types);
+    void SetRates(SharedVideoEncoder *subscriber,
+                  const webrtc::VideoEncoder::RateControlParameters &parameters);
+    webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const;
+
+    Result OnEncodedImage(const webrtc::EncodedImage &encoded_image,
+                          const webrtc::CodecSpecificInfo *codec_specific_info) override;
+
+    // rtc::VideoSinkInterface
+    void OnFrame(const webrtc::VideoFrame &frame) override;
+
+    // EncodedVideoSource
+    std::shared_ptr<Observable<V4l2Buffer>> AsEncodedObservable() override;
+    void RequestKeyFrame() override;
+
+  private:
+    struct FrameMeta {
+        uint32_t rtp_timestamp;
+        int64_t ntp_time_ms;
+        int64_t render_time_ms;
+        webrtc::VideoRotation rotation;
+    };
+
+    struct Subscriber {
+        webrtc::EncodedImageCallback *callback = nullptr;
+        bool is_active = false;
+        std::optional<webrtc::VideoEncoder::RateControlParameters> rates;
+    };
+
+    struct PendingFrame {
+        uint32_t rtp_timestamp;
+        int64_t timestamp_us;
+        std::map<SharedVideoEncoder *, FrameMeta> receivers;
+    };
+
+    struct EncodedFrame {
+        int64_t timestamp_us;
+        webrtc::EncodedImage image;
+        webrtc::CodecSpecificInfo codec_specific;
+    };
+
+    bool is_initialized_;
+    bool pending_key_frame_;
+    webrtc::VideoCodec codec_;
+    std::unique_ptr<webrtc::VideoEncoder> encoder_;
+    std::map<SharedVideoEncoder *, Subscriber> subscribers_;
+    std::deque<PendingFrame> pending_frames_;
+    std::deque<EncodedFrame> encoded_frames_;
+    // 0 if the encoder is only run for the peers.
+    int always_on_fps_;
+    Subject<V4l2Buffer> encoded_subject_;
+
+    // the latest frame of the track, a late one is replaced rather than queued.
+    std::mutex frame_mtx_;
+    std::condition_variable frame_cond_;
+    std::optional<webrtc::VideoFrame> next_frame_;
+    std::unique_ptr<Worker> worker_;
+
+    // lock order: encoder_mtx_ -> callback_mtx_ -> tap_mtx_ -> mtx_, the encoded observers
+    // are called under tap_mtx_ and may request a key frame.
+    std::mutex callback_mtx_;
+    std::mutex encoder_mtx_;
+    mutable std::mutex mtx_;
+    std::mutex tap_mtx_;
+
+    void EncodeNextFrame();
+    bool InitAlwaysOn(int width, int height);
+    void Publish(const webrtc::EncodedImage &encoded_image, int64_t timestamp_us);
+    void ApplyRates();
+    void Deliver(SharedVideoEncoder *subscriber, const webrtc::EncodedImage &encoded_image,
+                 const webrtc::CodecSpecificInfo *codec_specific_info, const FrameMeta &meta);
+};
+
+/* A lightweight per-peer encoder that forwards everything to the hub. */
+class SharedVideoEncoder : public webrtc::VideoEncoder {
+  public:
+    static std::unique_ptr<webrtc::VideoEncoder> Create(std::shared_ptr<VideoEncoderHub> hub);
+    SharedVideoEncoder(std::shared_ptr<VideoEncoderHub> hub);
+    ~SharedVideoEncoder();
+
+    int32_t InitEncode(const webrtc::VideoCodec *codec_settings,
+                       const VideoEncoder::Settings &settings) override;
+    int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback *callback) override;
+    int32_t Release() override;
+    int32_t Encode(const webrtc::VideoFrame &frame,
+                   const std::vector<webrtc::VideoFrameType> *frame_types) override;
+    void SetRates(const RateControlParameters &parameters) override;
+    webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+  private:
+    std::shared_ptr<VideoEncoderHub> hub_;
+};
+
+#endif // SHARED_VIDEO_ENCODER_H_
@@ -0,0 +1,40 @@
+#include "track/raw_h264_track_source.h"
+
+#include "common/v4l2_frame_buffer.h"
+
+rtc::scoped_refptr<RawH264TrackSource>
+RawH264TrackSource::Create(std::shared_ptr<VideoCapturer> capturer) {
+    auto obj = rtc::make_ref_counted<RawH264TrackSource>(std::move(capturer));
+    obj->StartTrack();
+    return obj;
+}
+
+RawH264TrackSource::RawH264TrackSource(std::shared_ptr<VideoCapturer> capturer)
+    : ScaleTrackSource(capturer) {}
+
+RawH264TrackSource::~RawH264TrackSource() {}
+
+void RawH264TrackSource::StartTrack() {
+    auto observer = capturer->AsRawBufferObservable();
+    observer->Subscribe([this](V4l2Buffer buffer) {
+        OnPacketCaptured(buffer);
+    });
+}
+
+void RawH264TrackSource::OnPacketCaptured(V4l2Buffer buffer) {
+    const int64_t timestamp_us = CaptureTimestampUs(buffer.timestamp);
+    const int64_t translated_timestamp_us =
+        timestamp_aligner.TranslateTimestamp(timestamp_us, rtc::TimeMicros());
+
+    // without a lease the capture buffer is queued back to the camera right after this callback.
+    auto frame_buffer = V4l2FrameBuffer::Create(width, height, buffer, V4L2_PIX_FMT_H264);
+    if (!buffer.lease) {
+        frame_buffer->CopyBufferData();
+    }
+
+    OnFrame(webrtc::VideoFrame::Builder()
+                .set_video_frame_buffer(frame_buffer)
+                .set_rotation(webrtc::kVideoRotation_0)
+                .set_timestamp_us(translated_timestamp_us)
+                .build());
+}
@@ -0,0 +1,19 @@
+#ifndef RAW_H264_TRACK_SOURCE_H_
+#define RAW_H264_TRACK_SOURCE_H_
+
+#include "track/scale_track_source.h"
+
+/* Feeds the camera's h264 packets into the track as native frames. The frames are never scaled
+ * or dropped here, since losing a P-frame would break the rest of the GOP. */
+class RawH264TrackSource : public ScaleTrackSource {
+  public:
+    static rtc::scoped_refptr<RawH264TrackSource> Create(std::shared_ptr<VideoCapturer> capturer);
+    RawH264TrackSource(std::shared_ptr<VideoCapturer> capturer);
+    ~RawH264TrackSource();
+    void StartTrack() override;
+
+  private:
+    void OnPacketCaptured(V4l2Buffer buffer);
+};
+
+#endif
@@ -7,6 +7,8 @@
 #include <api/video/video_frame_buffer.h>
 #include <third_party/libyuv/include/libyuv.h>
 
+#include "common/frame_buffer_pool.h"
+#include "common/latency_stats.h"
 #include "common/logging.h"
 #include "common/v4l2_frame_buffer.h"
 
@@ -30,13 +32,25 @@ ScaleTrackSource::~ScaleTrackSource() {
 
 void ScaleTrackSource::StartTrack() {
     auto observer = capturer->AsFrameBufferObservable();
-    observer->Subscribe([this](rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer) {
+    observer->Subscribe([this](rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
         OnFrameCaptured(frame_buffer);
     });
 }
 
-void ScaleTrackSource::OnFrameCaptured(rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer) {
-    const int64_t timestamp_us = rtc::TimeMicros();
+int64_t ScaleTrackSource::CaptureTimestampUs(const struct timeval &capture_time) {
+    static LatencyHistogram &latency = LatencyStats::Stage("capture_to_track");
+
+    const int64_t now_us = rtc::TimeMicros();
+    const int64_t capture_us = LatencyStats::ToUs(capture_time);
+    if (capture_us <= 0 || capture_us > now_us) {
+        return now_us;
+    }
+    latency.RecordSince(capture_time);
+    return capture_us;
+}
+
+void ScaleTrackSource::OnFrameCaptured(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
+    const int64_t timestamp_us = CaptureTimestampUs(frame_buffer->timestamp());
     const int64_t translated_timestamp_us =
         timestamp_aligner.TranslateTimestamp(timestamp_us, rtc::TimeMicros());
 
@@ -46,12 +60,12 @@ void ScaleTrackSource::OnFrameCaptured(rtc::scoped_refptr<webrtc::VideoFrameBuff
         return;
     }
 
-    rtc::scoped_refptr<webrtc::VideoFrameBuffer> dst_buffer = frame_buffer;
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> dst_buffer(frame_buffer);
 
     if (adapted_width != width || adapted_height != height) {
         int dst_stride = std::ceil((double)adapted_width / kBufferAlignment) * kBufferAlignment;
-        auto i420_buffer = webrtc::I420Buffer::Create(adapted_width, adapted_height, dst_stride,
-                                                      dst_stride / 2, dst_stride / 2);
+        auto i420_buffer = FrameBufferPool::Shared()->CreateI420Buffer(
+            adapted_width, adapted_height, dst_stride, dst_stride / 2);
         i420_buffer->ScaleFrom(*frame_buffer->ToI420());
         dst_buffer = i420_buffer;
     }
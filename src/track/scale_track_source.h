@@ -25,8 +25,11 @@ class ScaleTrackSource : public rtc::AdaptedVideoTrackSource {
     std::shared_ptr<VideoCapturer> capturer;
     rtc::TimestampAligner timestamp_aligner;
 
+    // prefers the kernel capture time, so the frame timestamps reflect the glass-to-track delay.
+    int64_t CaptureTimestampUs(const struct timeval &capture_time);
+
   private:
-    void OnFrameCaptured(rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer);
+    void OnFrameCaptured(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer);
 };
 
 #endif
@@ -31,6 +31,17 @@ V4l2DmaTrackSource::~V4l2DmaTrackSource() {
 void V4l2DmaTrackSource::Init() {
     scaler = std::make_unique<V4l2Scaler>();
     scaler->Configure(width, height, width, height, is_dma_src_, true);
+    // the scaled frames are stamped with the translated time, which is the submission's tag.
+    scaler->OnCapture([this](V4l2Buffer &scaled_buffer, uint64_t translated_timestamp_us) {
+        auto dst_buffer = V4l2FrameBuffer::Create(config_width_, config_height_, scaled_buffer,
+                                                  V4L2_PIX_FMT_YUV420);
+
+        OnFrame(webrtc::VideoFrame::Builder()
+                    .set_video_frame_buffer(dst_buffer)
+                    .set_rotation(webrtc::kVideoRotation_0)
+                    .set_timestamp_us((int64_t)translated_timestamp_us)
+                    .build());
+    });
     scaler->Start();
 }
 
@@ -42,7 +53,7 @@ void V4l2DmaTrackSource::StartTrack() {
 }
 
 void V4l2DmaTrackSource::OnFrameCaptured(V4l2Buffer decoded_buffer) {
-    const int64_t timestamp_us = rtc::TimeMicros();
+    const int64_t timestamp_us = CaptureTimestampUs(decoded_buffer.timestamp);
     const int64_t translated_timestamp_us =
         timestamp_aligner.TranslateTimestamp(timestamp_us, rtc::TimeMicros());
 
@@ -60,15 +71,5 @@ void V4l2DmaTrackSource::OnFrameCaptured(V4l2Buffer decoded_buffer) {
         scaler->Start();
     }
 
-    scaler->EmplaceBuffer(
-        decoded_buffer, [this, translated_timestamp_us](V4l2Buffer scaled_buffer) {
-            auto dst_buffer = V4l2FrameBuffer::Create(config_width_, config_height_, scaled_buffer,
-                                                      V4L2_PIX_FMT_YUV420);
-
-            OnFrame(webrtc::VideoFrame::Builder()
-                        .set_video_frame_buffer(dst_buffer)
-                        .set_rotation(webrtc::kVideoRotation_0)
-                        .set_timestamp_us(translated_timestamp_us)
-                        .build());
-        });
+    scaler->EmplaceBuffer(decoded_buffer, translated_timestamp_us);
 }
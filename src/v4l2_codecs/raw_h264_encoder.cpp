@@ -0,0 +1,130 @@
+#include "v4l2_codecs/raw_h264_encoder.h"
+#include "common/h264_utils.h"
+#include "common/latency_stats.h"
+#include "common/logging.h"
+#include "common/v4l2_frame_buffer.h"
+
+/* Wraps the copied camera packet as the encoded data, so it won't be copied once more. */
+class RawH264ImageBuffer : public webrtc::EncodedImageBufferInterface {
+  public:
+    RawH264ImageBuffer(rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer)
+        : frame_buffer_(frame_buffer) {}
+
+    const uint8_t *data() const override {
+        return static_cast<const uint8_t *>(frame_buffer_->Data());
+    }
+    uint8_t *data() override {
+        return const_cast<uint8_t *>(static_cast<const uint8_t *>(frame_buffer_->Data()));
+    }
+    size_t size() const override { return frame_buffer_->size(); }
+
+  private:
+    rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer_;
+};
+
+std::unique_ptr<webrtc::VideoEncoder>
+RawH264Encoder::Create(std::shared_ptr<VideoCapturer> capturer) {
+    return std::make_unique<RawH264Encoder>(capturer);
+}
+
+RawH264Encoder::RawH264Encoder(std::shared_ptr<VideoCapturer> capturer)
+    : has_first_keyframe_(false),
+      capturer_(capturer),
+      callback_(nullptr) {}
+
+RawH264Encoder::~RawH264Encoder() {}
+
+int32_t RawH264Encoder::InitEncode(const webrtc::VideoCodec *codec_settings,
+                                   const VideoEncoder::Settings &settings) {
+    if (codec_settings->codecType != webrtc::kVideoCodecH264) {
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+
+    encoded_image_.timing_.flags = webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
+    encoded_image_.content_type_ = webrtc::VideoContentType::UNSPECIFIED;
+
+    has_first_keyframe_ = false;
+    capturer_->RequestKeyFrame();
+
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RawH264Encoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback *callback) {
+    callback_ = callback;
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RawH264Encoder::Release() {
+    has_first_keyframe_ = false;
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RawH264Encoder::Encode(const webrtc::VideoFrame &frame,
+                               const std::vector<webrtc::VideoFrameType> *frame_types) {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer = frame.video_frame_buffer();
+    if (frame_buffer->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+        ERROR_PRINT("Only the h264 packets from the camera can be passed through.");
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+
+    rtc::scoped_refptr<V4l2FrameBuffer> raw_buffer(
+        static_cast<V4l2FrameBuffer *>(frame_buffer.get()));
+    // the flag of some uvc cameras is set on frames without the parameter sets, which the
+    // receivers can't start decoding from.
+    bool is_key_frame =
+        (raw_buffer->flags() & V4L2_BUF_FLAG_KEYFRAME) != 0 &&
+        H264Util::IsKeyFrame(static_cast<const uint8_t *>(raw_buffer->Data()), raw_buffer->size());
+
+    if (frame_types) {
+        if ((*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey && !is_key_frame) {
+            capturer_->RequestKeyFrame();
+        } else if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+    }
+
+    if (!has_first_keyframe_) {
+        if (!is_key_frame) {
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+        has_first_keyframe_ = true;
+    }
+
+    webrtc::CodecSpecificInfo codec_specific;
+    codec_specific.codecType = webrtc::kVideoCodecH264;
+    codec_specific.codecSpecific.H264.packetization_mode =
+        webrtc::H264PacketizationMode::NonInterleaved;
+
+    encoded_image_.SetEncodedData(rtc::make_ref_counted<RawH264ImageBuffer>(raw_buffer));
+    encoded_image_.SetTimestamp(frame.timestamp());
+    encoded_image_.SetColorSpace(frame.color_space());
+    encoded_image_._encodedWidth = raw_buffer->width();
+    encoded_image_._encodedHeight = raw_buffer->height();
+    encoded_image_.capture_time_ms_ = frame.render_time_ms();
+    encoded_image_.ntp_time_ms_ = frame.ntp_time_ms();
+    encoded_image_.rotation_ = frame.rotation();
+    encoded_image_._frameType = is_key_frame ? webrtc::VideoFrameType::kVideoFrameKey
+                                             : webrtc::VideoFrameType::kVideoFrameDelta;
+
+    auto result = callback_->OnEncodedImage(encoded_image_, &codec_specific);
+    if (result.error != webrtc::EncodedImageCallback::Result::OK) {
+        ERROR_PRINT("Failed to send the frame => %d", result.error);
+    }
+
+    static LatencyHistogram &latency = LatencyStats::Stage("capture_to_send");
+    latency.RecordSince(raw_buffer->timestamp());
+
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void RawH264Encoder::SetRates(const RateControlParameters &parameters) {
+    // the bitrate is controlled by the camera, which is shared with the recorder.
+}
+
+webrtc::VideoEncoder::EncoderInfo RawH264Encoder::GetEncoderInfo() const {
+    EncoderInfo info;
+    info.supports_native_handle = true;
+    info.is_hardware_accelerated = true;
+    info.implementation_name = "V4L2 H264 Camera Passthrough";
+    return info;
+}
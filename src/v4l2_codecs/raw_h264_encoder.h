@@ -0,0 +1,34 @@
+#ifndef RAW_H264_ENCODER_H_
+#define RAW_H264_ENCODER_H_
+
+// WebRTC
+#include <api/video_codecs/video_encoder.h>
+#include <modules/video_coding/codecs/h264/include/h264.h>
+
+#include "capturer/video_capturer.h"
+
+/* Sends the h264 packets from the camera as they are, the key frame requests are forwarded to
+ * the camera instead of a local encoder. */
+class RawH264Encoder : public webrtc::VideoEncoder {
+  public:
+    static std::unique_ptr<webrtc::VideoEncoder> Create(std::shared_ptr<VideoCapturer> capturer);
+    RawH264Encoder(std::shared_ptr<VideoCapturer> capturer);
+    ~RawH264Encoder();
+
+    int32_t InitEncode(const webrtc::VideoCodec *codec_settings,
+                       const VideoEncoder::Settings &settings) override;
+    int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback *callback) override;
+    int32_t Release() override;
+    int32_t Encode(const webrtc::VideoFrame &frame,
+                   const std::vector<webrtc::VideoFrameType> *frame_types) override;
+    void SetRates(const RateControlParameters &parameters) override;
+    webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+  private:
+    bool has_first_keyframe_;
+    std::shared_ptr<VideoCapturer> capturer_;
+    webrtc::EncodedImage encoded_image_;
+    webrtc::EncodedImageCallback *callback_;
+};
+
+#endif
@@ -1,20 +1,47 @@
 #include "v4l2_codecs/v4l2_codec.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
 #include "common/logging.h"
 
+// how long a producer may be held back by a full codec before the frame is dropped.
+static const int kBackpressureTimeoutMs = 100;
+
+static struct timeval SequenceToTimestamp(uint64_t sequence) {
+    struct timeval tv;
+    tv.tv_sec = sequence / 1000000;
+    tv.tv_usec = sequence % 1000000;
+    return tv;
+}
+
+static uint64_t TimestampToSequence(const struct timeval &tv) {
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 V4l2Codec::~V4l2Codec() { ReleaseCodec(); }
 
-bool V4l2Codec::Open(const char *file_name) {
+bool V4l2Codec::Open(const char *file_name, const char *stage_name) {
     file_name_ = file_name;
+    latency_ = &LatencyStats::Stage(stage_name ? stage_name : file_name);
     fd_ = V4l2Util::OpenDevice(file_name);
     if (fd_ < 0) {
         return false;
     }
+    // both queues are drained until EAGAIN on every readiness event.
+    fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
     return true;
 }
 
+void V4l2Codec::SetQueueDepth(int depth) { queue_depth_ = depth; }
+
 bool V4l2Codec::PrepareBuffer(V4l2BufferGroup *gbuffer, int width, int height, uint32_t pix_fmt,
                               v4l2_buf_type type, v4l2_memory memory, int buffer_num,
                               bool has_dmafd) {
+    if (queue_depth_ > 0) {
+        buffer_num = queue_depth_;
+    }
+
     if (!V4l2Util::InitBuffer(fd_, gbuffer, type, memory, has_dmafd)) {
         return false;
     }
@@ -28,7 +55,9 @@ bool V4l2Codec::PrepareBuffer(V4l2BufferGroup *gbuffer, int width, int height, u
     }
 
     if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
-        for (int i = 0; i < buffer_num; i++) {
+        output_buffer_index_.reset(gbuffer->num_buffers);
+        spare_index_ = -1;
+        for (int i = 0; i < gbuffer->num_buffers; i++) {
             output_buffer_index_.push(i);
         }
     } else if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
@@ -40,113 +69,224 @@ bool V4l2Codec::PrepareBuffer(V4l2BufferGroup *gbuffer, int width, int height, u
     return true;
 }
 
+void V4l2Codec::OnCapture(CaptureCallback on_capture) { on_capture_ = std::move(on_capture); }
+
+size_t V4l2Codec::max_in_flight() const { return num_submissions_; }
+
 void V4l2Codec::Start() {
-    worker_.reset(new Worker(file_name_, [this]() {
-        CaptureBuffer();
-    }));
+    // a frame may still be inside the codec after its output buffer is returned.
+    num_submissions_ = output_.num_buffers + capture_.num_buffers;
+    submissions_.reset(new Submission[num_submissions_]);
     abort_.store(false);
-    worker_->Run();
+    event_loop_->Add(
+        fd_, EPOLLIN | EPOLLOUT | EPOLLPRI,
+        [this](uint32_t events) {
+            OnEvents(events);
+        },
+        [this](uint32_t events) {
+            // nothing will be dequeued any more, so the producers stop waiting for it.
+            abort_.store(true);
+            NotifyWaiters();
+        });
 }
 
 void V4l2Codec::Stop() {
     abort_.store(true);
-    worker_.reset();
+    NotifyWaiters();
+    event_loop_->Remove(fd_);
 }
 
-void V4l2Codec::EmplaceBuffer(V4l2Buffer &buffer, std::function<void(V4l2Buffer &)> on_capture) {
-    if (output_buffer_index_.empty()) {
-        return;
+V4l2Codec::Submission &V4l2Codec::SubmissionAt(uint64_t sequence) {
+    return submissions_[sequence % num_submissions_];
+}
+
+void V4l2Codec::ClearSubmission(Submission &submission) {
+    submission.is_pending.store(false, std::memory_order_release);
+}
+
+bool V4l2Codec::CanSubmit() {
+    return (spare_index_ >= 0 || !output_buffer_index_.empty()) && num_submissions_ > 0 &&
+           !SubmissionAt(next_sequence_).is_pending.load(std::memory_order_acquire);
+}
+
+void V4l2Codec::NotifyWaiters() {
+    // the freed index or slot is published by a release store, which could otherwise be
+    // ordered after this load, and a waiter that just found nothing free would not be woken.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_waiters_.load() > 0) {
+        // pairs with the predicate check under the lock, so the wake-up can not be missed.
+        std::lock_guard<std::mutex> lock(mtx_);
+        cond_.notify_all();
+    }
+}
+
+bool V4l2Codec::WaitForSubmission() {
+    if (CanSubmit()) {
+        return true;
+    }
+
+    if (event_loop_->IsLoopThread()) {
+        // nobody else can dequeue for us on the loop thread, reclaim the finished ones inline.
+        DequeueOutputBuffers();
+        return CanSubmit();
     }
 
-    int index = output_buffer_index_.front();
-    output_buffer_index_.pop();
+    std::unique_lock<std::mutex> lock(mtx_);
+    num_waiters_++;
+    // pairs with the fence in NotifyWaiters(), either side sees the other's update.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool is_ready =
+        cond_.wait_for(lock, std::chrono::milliseconds(kBackpressureTimeoutMs), [this] {
+            return abort_.load() || CanSubmit();
+        });
+    num_waiters_--;
+    return is_ready && !abort_.load();
+}
+
+bool V4l2Codec::EmplaceBuffer(V4l2Buffer &buffer, uint64_t tag) {
+    if (abort_.load() || !WaitForSubmission()) {
+        DEBUG_PRINT("fd(%d) is busy, drop the frame.", fd_);
+        return false;
+    }
 
+    int index = spare_index_;
+    spare_index_ = -1;
+    if (index < 0 && !output_buffer_index_.pop(index)) {
+        return false;
+    }
+    uint64_t sequence = next_sequence_++;
+
+    v4l2_buffer *buf = &output_.buffers[index].inner;
     if (output_.memory == V4L2_MEMORY_DMABUF) {
-        v4l2_buffer *buf = &output_.buffers[index].inner;
         buf->m.planes[0].m.fd = buffer.dmafd;
         buf->m.planes[0].bytesused = buffer.length;
         buf->m.planes[0].length = buffer.length;
     } else {
         memcpy((uint8_t *)output_.buffers[index].start, (uint8_t *)buffer.start, buffer.length);
     }
+    buf->timestamp = SequenceToTimestamp(sequence);
+
+    auto &submission = SubmissionAt(sequence);
+    submission.sequence = sequence;
+    submission.submitted_us = LatencyStats::NowUs();
+    submission.timestamp = buffer.timestamp;
+    submission.tag = tag;
+    submission.is_pending.store(true, std::memory_order_release);
 
-    if (!V4l2Util::QueueBuffer(fd_, &output_.buffers[index].inner)) {
+    if (!V4l2Util::QueueBuffer(fd_, buf)) {
         ERROR_PRINT("QueueBuffer V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE. fd(%d) at index %d", fd_,
                     index);
-        output_buffer_index_.push(index);
-        return;
+        // the index is kept by this thread, the ring only flows from the loop thread.
+        spare_index_ = index;
+        submission.is_pending.store(false, std::memory_order_release);
+        return false;
     }
 
-    capturing_tasks_.push(on_capture);
+    return true;
 }
 
-bool V4l2Codec::CaptureBuffer() {
-    V4l2Buffer buffer = {};
+void V4l2Codec::OnEvents(uint32_t events) {
+    if (abort_.load()) {
+        return;
+    }
 
-    fd_set fds[2];
-    fd_set *rd_fds = &fds[0]; /* for capture */
-    fd_set *ex_fds = &fds[1]; /* for handle event */
-    FD_ZERO(rd_fds);
-    FD_SET(fd_, rd_fds);
-    FD_ZERO(ex_fds);
-    FD_SET(fd_, ex_fds);
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 500000;
+    if (events & EPOLLOUT) {
+        DequeueOutputBuffers();
+    }
 
-    int r = select(fd_ + 1, rd_fds, NULL, ex_fds, &tv);
+    if (events & EPOLLIN) {
+        DequeueCaptureBuffers();
+    }
 
-    if (abort_.load()) {
-        return false;
-    } else if (r <= 0) { // failed or timeout
-        return false;
+    if (events & EPOLLPRI) {
+        HandleEvent();
     }
+}
 
-    if (rd_fds && FD_ISSET(fd_, rd_fds)) {
-        struct v4l2_buffer buf = {0};
-        struct v4l2_plane planes = {0};
+void V4l2Codec::DequeueOutputBuffers() {
+    while (true) {
+        struct v4l2_buffer buf = {};
+        struct v4l2_plane planes = {};
         buf.memory = output_.memory;
         buf.length = 1;
         buf.m.planes = &planes;
         buf.type = output_.type;
         if (!V4l2Util::DequeueBuffer(fd_, &buf)) {
-            return false;
+            break;
         }
+
         output_buffer_index_.push(buf.index);
+        NotifyWaiters();
+    }
+}
 
-        buf = {};
-        planes = {};
+void V4l2Codec::DequeueCaptureBuffers() {
+    while (!abort_.load()) {
+        struct v4l2_buffer buf = {};
+        struct v4l2_plane planes = {};
         buf.memory = capture_.memory;
         buf.length = 1;
         buf.m.planes = &planes;
         buf.type = capture_.type;
         if (!V4l2Util::DequeueBuffer(fd_, &buf)) {
-            return false;
+            break;
         }
 
-        buffer.start = capture_.buffers[buf.index].start;
-        buffer.length = buf.m.planes[0].bytesused;
-        buffer.dmafd = capture_.buffers[buf.index].dmafd;
-        buffer.flags = buf.flags;
-
-        if (!capturing_tasks_.empty()) {
-            auto task = capturing_tasks_.front();
-            capturing_tasks_.pop();
-            task(buffer);
-        } else {
-            return false;
+        Submission *submission = TakeSubmission(TimestampToSequence(buf.timestamp));
+        if (submission) {
+            latency_->Record(LatencyStats::NowUs() - submission->submitted_us);
+            if (buf.m.planes[0].bytesused > 0) {
+                V4l2Buffer buffer;
+                buffer.start = capture_.buffers[buf.index].start;
+                buffer.length = buf.m.planes[0].bytesused;
+                buffer.dmafd = capture_.buffers[buf.index].dmafd;
+                buffer.flags = buf.flags;
+                buffer.timestamp = submission->timestamp;
+                if (on_capture_) {
+                    on_capture_(buffer, submission->tag);
+                }
+            }
+            ClearSubmission(*submission);
+            NotifyWaiters();
         }
 
         if (!V4l2Util::QueueBuffer(fd_, &capture_.buffers[buf.index].inner)) {
-            return false;
+            break;
         }
     }
+}
 
-    if (ex_fds && FD_ISSET(fd_, ex_fds)) {
-        ERROR_PRINT("Exception in fd(%d).", fd_);
-        HandleEvent();
+V4l2Codec::Submission *V4l2Codec::TakeSubmission(uint64_t sequence) {
+    if (num_submissions_ == 0) {
+        return nullptr;
     }
-    return true;
+
+    auto *matched = &SubmissionAt(sequence);
+    if (!matched->is_pending.load(std::memory_order_acquire) || matched->sequence != sequence) {
+        // the driver did not copy the cookie, fall back to the oldest submission.
+        matched = nullptr;
+        for (size_t i = 0; i < num_submissions_; i++) {
+            auto &pending = submissions_[i];
+            if (pending.is_pending.load(std::memory_order_acquire) &&
+                (!matched || pending.sequence < matched->sequence)) {
+                matched = &pending;
+            }
+        }
+        if (!matched) {
+            return nullptr;
+        }
+        sequence = matched->sequence;
+    }
+
+    // frames are not reordered, so the older submissions will never produce a result.
+    for (size_t i = 0; i < num_submissions_; i++) {
+        auto &pending = submissions_[i];
+        if (pending.is_pending.load(std::memory_order_acquire) && pending.sequence < sequence) {
+            ClearSubmission(pending);
+        }
+    }
+
+    return matched;
 }
 
 void V4l2Codec::ReleaseCodec() {
@@ -155,8 +295,11 @@ void V4l2Codec::ReleaseCodec() {
     }
 
     Stop();
-    capturing_tasks_ = {};
-    output_buffer_index_ = {};
+    submissions_.reset();
+    num_submissions_ = 0;
+    output_buffer_index_.reset(0);
+    spare_index_ = -1;
+    next_sequence_ = 1;
 
     V4l2Util::StreamOff(fd_, output_.type);
     V4l2Util::StreamOff(fd_, capture_.type);
@@ -4,38 +4,92 @@
 #include "common/v4l2_utils.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
-#include <queue>
+#include <memory>
+#include <mutex>
 
-#include "common/worker.h"
+#include "common/event_loop.h"
+#include "common/latency_stats.h"
+#include "common/spsc_queue.h"
 
+/* The OUTPUT and CAPTURE queues are serviced independently, so several frames can be in flight.
+ * Each submission is tagged with a cookie in the v4l2 timestamp, which the driver copies to the
+ * matching CAPTURE buffer. EmplaceBuffer() is expected to be called from one thread only. */
 class V4l2Codec {
   public:
+    // gets each result with the tag of its submission, on the loop thread.
+    using CaptureCallback = std::function<void(V4l2Buffer &, uint64_t)>;
+
     V4l2Codec()
-        : fd_(0){};
+        : fd_(0),
+          queue_depth_(0),
+          abort_(true),
+          event_loop_(EventLoop::Shared()),
+          next_sequence_(1),
+          spare_index_(-1),
+          latency_(nullptr),
+          num_submissions_(0),
+          num_waiters_(0){};
     virtual ~V4l2Codec();
-    bool Open(const char *file_name);
+    // the submit-to-complete latency is recorded under the stage name, or the file name.
+    bool Open(const char *file_name, const char *stage_name = nullptr);
     bool PrepareBuffer(V4l2BufferGroup *gbuffer, int width, int height, uint32_t pix_fmt,
                        v4l2_buf_type type, v4l2_memory memory, int buffer_num,
                        bool has_dmafd = false);
+    // overrides the codec's default buffer count, must be called before configuring.
+    void SetQueueDepth(int depth);
+    // the callback is set once before starting, so nothing is allocated per frame.
+    void OnCapture(CaptureCallback on_capture);
     void Start();
     void Stop();
-    void EmplaceBuffer(V4l2Buffer &buffer, std::function<void(V4l2Buffer &)> on_capture);
+    bool EmplaceBuffer(V4l2Buffer &buffer, uint64_t tag = 0);
+    // the submissions that can be pending at once, valid after Start().
+    size_t max_in_flight() const;
     void ReleaseCodec();
 
   protected:
     int fd_;
+    int queue_depth_;
     std::atomic<bool> abort_;
     V4l2BufferGroup output_;
     V4l2BufferGroup capture_;
-    std::queue<int> output_buffer_index_;
-    std::unique_ptr<Worker> worker_;
-    std::queue<std::function<void(V4l2Buffer &)>> capturing_tasks_;
+    std::shared_ptr<EventLoop> event_loop_;
     virtual void HandleEvent(){};
 
   private:
+    // a slot is written by the producer while free and by the loop thread while pending.
+    struct Submission {
+        std::atomic<bool> is_pending{false};
+        uint64_t sequence = 0;
+        int64_t submitted_us = 0;
+        struct timeval timestamp = {0, 0};
+        uint64_t tag = 0;
+    };
+
     const char *file_name_;
-    bool CaptureBuffer();
+    uint64_t next_sequence_;
+    int spare_index_;
+    LatencyHistogram *latency_;
+    CaptureCallback on_capture_;
+    SpscQueue<int> output_buffer_index_;
+    std::unique_ptr<Submission[]> submissions_;
+    size_t num_submissions_;
+
+    // only taken when a producer has to wait for a free buffer.
+    std::atomic<int> num_waiters_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+
+    bool CanSubmit();
+    bool WaitForSubmission();
+    void NotifyWaiters();
+    Submission &SubmissionAt(uint64_t sequence);
+    void ClearSubmission(Submission &submission);
+    void OnEvents(uint32_t events);
+    void DequeueOutputBuffers();
+    void DequeueCaptureBuffers();
+    Submission *TakeSubmission(uint64_t sequence);
 };
 
 #endif // V4L2_CODEC_
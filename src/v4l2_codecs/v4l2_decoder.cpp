@@ -8,7 +8,7 @@ const char *DECODER_FILE = "/dev/video10";
 const int BUFFER_NUM = 2;
 
 bool V4l2Decoder::Configure(int width, int height, uint32_t src_pix_fmt, bool is_dma_dst) {
-    if (!Open(DECODER_FILE)) {
+    if (!Open(DECODER_FILE, "decoder")) {
         DEBUG_PRINT("Failed to turn on decoder: %s", DECODER_FILE);
         return false;
     }
@@ -36,7 +36,8 @@ void V4l2Decoder::HandleEvent() {
                 V4l2Util::StreamOff(fd_, capture_.type);
                 V4l2Util::DeallocateBuffer(fd_, &capture_);
                 V4l2Util::SetFormat(fd_, &capture_, 0, 0, 0);
-                V4l2Util::AllocateBuffer(fd_, &capture_, BUFFER_NUM);
+                V4l2Util::AllocateBuffer(fd_, &capture_, capture_.num_buffers);
+                V4l2Util::QueueBuffers(fd_, &capture_);
                 V4l2Util::StreamOn(fd_, capture_.type);
                 break;
             case V4L2_EVENT_EOS:
@@ -10,8 +10,8 @@ V4l2Encoder::V4l2Encoder()
       bitrate_bps_(10000000),
       h264_profile_(V4L2_MPEG_VIDEO_H264_PROFILE_BASELINE) {}
 
-bool V4l2Encoder::Configure(int width, int height, bool is_dma_src) {
-    if (!Open(ENCODER_FILE)) {
+bool V4l2Encoder::Configure(int width, int height, bool is_dma_src, const char *stage_name) {
+    if (!Open(ENCODER_FILE, stage_name)) {
         DEBUG_PRINT("Failed to turn on encoder: %s", ENCODER_FILE);
         return false;
     }
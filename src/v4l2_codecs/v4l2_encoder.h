@@ -11,7 +11,8 @@ class V4l2Encoder : public V4l2Codec {
     V4l2Encoder();
     ~V4l2Encoder() = default;
 
-    bool Configure(int width, int height, bool is_dma_src);
+    // the stage name keeps the latency of each encoder apart, e.g. the recorder's one.
+    bool Configure(int width, int height, bool is_dma_src, const char *stage_name = "encoder");
     void SetProfile(uint32_t h264_profile);
     void SetBitrate(uint32_t adjusted_bitrate_bps);
     void SetFps(int adjusted_fps);
@@ -1,4 +1,5 @@
 #include "v4l2_codecs/v4l2_h264_encoder.h"
+#include "common/latency_stats.h"
 #include "common/logging.h"
 #include "common/v4l2_frame_buffer.h"
 
@@ -10,7 +11,8 @@ V4l2H264Encoder::V4l2H264Encoder()
     : fps_adjuster_(30),
       is_dma_(true),
       bitrate_adjuster_(.85, 1),
-      callback_(nullptr) {}
+      callback_(nullptr),
+      next_tag_(0) {}
 
 V4l2H264Encoder::~V4l2H264Encoder() {}
 
@@ -30,7 +32,12 @@ int32_t V4l2H264Encoder::InitEncode(const webrtc::VideoCodec *codec_settings,
 
     encoder_ = std::make_unique<V4l2Encoder>();
     encoder_->Configure(width_, height_, is_dma_);
+    encoder_->OnCapture([this](V4l2Buffer &encoded_buffer, uint64_t tag) {
+        SendFrame(frame_infos_[tag % frame_infos_.size()], encoded_buffer);
+    });
     encoder_->Start();
+    // one more than can be pending, the next one is filled before waiting for a free slot.
+    frame_infos_.assign(encoder_->max_in_flight() + 1, FrameInfo());
 
     return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -71,9 +78,16 @@ int32_t V4l2H264Encoder::Encode(const webrtc::VideoFrame &frame,
         src_buffer.length = i420_buffer_size;
     }
 
-    encoder_->EmplaceBuffer(src_buffer, [this, frame](V4l2Buffer encoded_buffer) {
-        SendFrame(frame, encoded_buffer);
-    });
+    // the slot is filled before the submission, which publishes it to the loop thread.
+    auto &info = frame_infos_[next_tag_ % frame_infos_.size()];
+    info.rtp_timestamp = frame.timestamp();
+    info.render_time_ms = frame.render_time_ms();
+    info.ntp_time_ms = frame.ntp_time_ms();
+    info.rotation = frame.rotation();
+    info.color_space = frame.color_space();
+    if (encoder_->EmplaceBuffer(src_buffer, next_tag_)) {
+        next_tag_++;
+    }
 
     return WEBRTC_VIDEO_CODEC_OK;
 }
@@ -98,7 +112,7 @@ webrtc::VideoEncoder::EncoderInfo V4l2H264Encoder::GetEncoderInfo() const {
     return info;
 }
 
-void V4l2H264Encoder::SendFrame(const webrtc::VideoFrame &frame, V4l2Buffer &encoded_buffer) {
+void V4l2H264Encoder::SendFrame(const FrameInfo &info, V4l2Buffer &encoded_buffer) {
     auto encoded_image_buffer =
         webrtc::EncodedImageBuffer::Create((uint8_t *)encoded_buffer.start, encoded_buffer.length);
 
@@ -108,13 +122,13 @@ void V4l2H264Encoder::SendFrame(const webrtc::VideoFrame &frame, V4l2Buffer &enc
         webrtc::H264PacketizationMode::NonInterleaved;
 
     encoded_image_.SetEncodedData(encoded_image_buffer);
-    encoded_image_.SetTimestamp(frame.timestamp());
-    encoded_image_.SetColorSpace(frame.color_space());
+    encoded_image_.SetTimestamp(info.rtp_timestamp);
+    encoded_image_.SetColorSpace(info.color_space);
     encoded_image_._encodedWidth = width_;
     encoded_image_._encodedHeight = height_;
-    encoded_image_.capture_time_ms_ = frame.render_time_ms();
-    encoded_image_.ntp_time_ms_ = frame.ntp_time_ms();
-    encoded_image_.rotation_ = frame.rotation();
+    encoded_image_.capture_time_ms_ = info.render_time_ms;
+    encoded_image_.ntp_time_ms_ = info.ntp_time_ms;
+    encoded_image_.rotation_ = info.rotation;
     encoded_image_._frameType = encoded_buffer.flags & V4L2_BUF_FLAG_KEYFRAME
                                     ? webrtc::VideoFrameType::kVideoFrameKey
                                     : webrtc::VideoFrameType::kVideoFrameDelta;
@@ -123,4 +137,8 @@ void V4l2H264Encoder::SendFrame(const webrtc::VideoFrame &frame, V4l2Buffer &enc
     if (result.error != webrtc::EncodedImageCallback::Result::OK) {
         ERROR_PRINT("Failed to send the frame => %d", result.error);
     }
+
+    // the capture time of native frames survives the decoder, scaler and encoder.
+    static LatencyHistogram &latency = LatencyStats::Stage("capture_to_send");
+    latency.RecordSince(encoded_buffer.timestamp);
 }
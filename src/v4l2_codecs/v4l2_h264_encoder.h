@@ -3,6 +3,7 @@
 
 // WebRTC
 #include <api/video_codecs/video_encoder.h>
+#include <api/video/video_frame.h>
 #include <common_video/include/bitrate_adjuster.h>
 #include <modules/video_coding/codecs/h264/include/h264.h>
 
@@ -24,6 +25,15 @@ class V4l2H264Encoder : public webrtc::VideoEncoder {
     webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
 
   protected:
+    // what the encoded image takes from its frame, kept by the encoder while it's in flight.
+    struct FrameInfo {
+        uint32_t rtp_timestamp = 0;
+        int64_t render_time_ms = 0;
+        int64_t ntp_time_ms = 0;
+        webrtc::VideoRotation rotation = webrtc::kVideoRotation_0;
+        absl::optional<webrtc::ColorSpace> color_space;
+    };
+
     int width_;
     int height_;
     int fps_adjuster_;
@@ -34,8 +44,11 @@ class V4l2H264Encoder : public webrtc::VideoEncoder {
     webrtc::EncodedImageCallback *callback_;
     webrtc::BitrateAdjuster bitrate_adjuster_;
     std::unique_ptr<V4l2Encoder> encoder_;
+    // indexed by the submission tag, the codec holds fewer than its size in flight.
+    std::vector<FrameInfo> frame_infos_;
+    uint64_t next_tag_;
 
-    virtual void SendFrame(const webrtc::VideoFrame &frame, V4l2Buffer &encoded_buffer);
+    virtual void SendFrame(const FrameInfo &info, V4l2Buffer &encoded_buffer);
 };
 
 #endif
@@ -6,7 +6,7 @@ const int BUFFER_NUM = 2;
 
 bool V4l2Scaler::Configure(int src_width, int src_height, int dst_width, int dst_height,
                            bool is_dma_src, bool is_dma_dst) {
-    if (!Open(SCALER_FILE)) {
+    if (!Open(SCALER_FILE, "scaler")) {
         DEBUG_PRINT("Failed to turn on scaler: %s", SCALER_FILE);
         return false;
     }
@@ -0,0 +1,25 @@
+#include "args.h"
+#include "capturer/v4l2_capturer.h"
+#include "motion/motion_detector.h"
+
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    Args args{.fps = 15,
+              .width = 1280,
+              .height = 720,
+              .motion_sensitivity = 60,
+              .format = V4L2_PIX_FMT_MJPEG,
+              .device = "/dev/video0"};
+
+    auto capturer = V4l2Capturer::Create(args);
+    auto motion_detector = MotionDetector::Create(args, capturer);
+    auto observer = motion_detector->AsObservable();
+    observer->Subscribe([](MotionEvent event) {
+        printf("Motion event: %s\n", event.ToString().c_str());
+    });
+
+    sleep(60);
+
+    return 0;
+}
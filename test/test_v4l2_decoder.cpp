@@ -19,12 +19,17 @@ void WriteYuvImage(void *start, int length, int index) {
     }
 }
 
+uint64_t TimestampUs(const timeval &timestamp) {
+    return (uint64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+}
+
 int main(int argc, char *argv[]) {
     std::mutex mtx;
     std::condition_variable cond_var;
     bool is_finished = false;
     int images_nb = 0;
     int record_sec = 1;
+    int mismatched = 0;
     Args args{.fps = 15,
               .width = 640,
               .height = 480,
@@ -35,24 +40,30 @@ int main(int argc, char *argv[]) {
     auto capturer = V4l2Capturer::Create(args);
     auto decoder = std::make_unique<V4l2Decoder>();
     decoder->Configure(args.width, args.height, capturer->format(), false);
+    decoder->OnCapture([&](V4l2Buffer &decoded_buffer, uint64_t tag) {
+        // the tag is the camera timestamp, which the result is given back with.
+        if (tag != TimestampUs(decoded_buffer.timestamp)) {
+            mismatched++;
+        }
+
+        if (is_finished) {
+            return;
+        }
+
+        if (images_nb++ < args.fps * record_sec) {
+            printf("Buffer index: %d\n  bytesused: %u\n", images_nb, decoded_buffer.length);
+            WriteYuvImage(decoded_buffer.start, decoded_buffer.length, images_nb);
+        } else {
+            is_finished = true;
+            cond_var.notify_all();
+        }
+    });
     decoder->Start();
 
     auto observer = capturer->AsRawBufferObservable();
     observer->Subscribe([&](V4l2Buffer buffer) {
         printf("Camera buffer: %u\n", buffer.length);
-        decoder->EmplaceBuffer(buffer, [&](V4l2Buffer decoded_buffer) {
-            if (is_finished) {
-                return;
-            }
-
-            if (images_nb++ < args.fps * record_sec) {
-                printf("Buffer index: %d\n  bytesused: %u\n", images_nb, decoded_buffer.length);
-                WriteYuvImage(decoded_buffer.start, decoded_buffer.length, images_nb);
-            } else {
-                is_finished = true;
-                cond_var.notify_all();
-            }
-        });
+        decoder->EmplaceBuffer(buffer, TimestampUs(buffer.timestamp));
     });
 
     std::unique_lock<std::mutex> lock(mtx);
@@ -63,6 +74,7 @@ int main(int argc, char *argv[]) {
     decoder->Stop();
     decoder->ReleaseCodec();
     observer->UnSubscribe();
+    printf("Mismatched tags: %d\n", mismatched);
 
-    return 0;
+    return mismatched == 0 ? 0 : 1;
 }
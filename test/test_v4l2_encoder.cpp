@@ -28,13 +28,45 @@ int main(int argc, char *argv[]) {
 
     auto encoder = std::make_unique<V4l2Encoder>();
     encoder->Configure(args.width, args.height, true);
+    int frame_count = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t submitted_frames = 0;
+    uint64_t next_tag = 0;
+    int mismatched = 0;
+    encoder->OnCapture([&](V4l2Buffer &encoded_buffer, uint64_t tag) {
+        // the results come back in the submitted order, the dropped ones leave gaps.
+        if (tag < next_tag) {
+            mismatched++;
+        }
+        next_tag = tag + 1;
+
+        if (is_finished) {
+            return;
+        }
+
+        auto current_time = std::chrono::steady_clock::now();
+        frame_count++;
+
+        if (std::chrono::duration_cast<std::chrono::seconds>(current_time - start_time)
+                .count() >= 1) {
+            auto duration =
+                std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time)
+                    .count();
+            double current_fps = static_cast<double>(frame_count) / (duration / 1000.0);
+            start_time = current_time;
+            printf("Codec FPS: %.2f\n", current_fps);
+            frame_count = 0;
+        }
+
+        if (images_nb++ > args.fps * record_sec) {
+            is_finished = true;
+            cond_var.notify_all();
+        }
+    });
     encoder->Start();
 
     int cam_frame_count = 0;
     auto cam_start_time = std::chrono::steady_clock::now();
-    int frame_count = 0;
-    auto start_time = std::chrono::steady_clock::now();
-
     observer->Subscribe([&](rtc::scoped_refptr<V4l2FrameBuffer> frame_buffer) {
         auto buffer = frame_buffer->GetRawBuffer();
 
@@ -60,30 +92,7 @@ int main(int argc, char *argv[]) {
             cam_frame_count = 0;
         }
 
-        encoder->EmplaceBuffer(buffer, [&](V4l2Buffer &encoded_buffer) {
-            if (is_finished) {
-                return;
-            }
-
-            auto current_time = std::chrono::steady_clock::now();
-            frame_count++;
-
-            if (std::chrono::duration_cast<std::chrono::seconds>(current_time - start_time)
-                    .count() >= 1) {
-                auto duration =
-                    std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time)
-                        .count();
-                double current_fps = static_cast<double>(frame_count) / (duration / 1000.0);
-                start_time = current_time;
-                printf("Codec FPS: %.2f\n", current_fps);
-                frame_count = 0;
-            }
-
-            if (images_nb++ > args.fps * record_sec) {
-                is_finished = true;
-                cond_var.notify_all();
-            }
-        });
+        encoder->EmplaceBuffer(buffer, submitted_frames++);
     });
 
     std::unique_lock<std::mutex> lock(mtx);
@@ -94,6 +103,7 @@ int main(int argc, char *argv[]) {
     encoder->Stop();
     encoder->ReleaseCodec();
     observer->UnSubscribe();
+    printf("Out of order results: %d\n", mismatched);
 
-    return 0;
+    return mismatched == 0 ? 0 : 1;
 }
@@ -23,12 +23,17 @@ void WriteImage(V4l2Buffer buffer, int index) {
     write(outfd, buffer.start, buffer.length);
 }
 
+uint64_t TimestampUs(const timeval &timestamp) {
+    return (uint64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+}
+
 int main(int argc, char *argv[]) {
     std::mutex mtx;
     std::condition_variable cond_var;
     bool is_finished = false;
     int images_nb = 0;
     int record_sec = 1;
+    int mismatched = 0;
     Args args{.fps = 15,
               .width = 640,
               .height = 480,
@@ -37,23 +42,29 @@ int main(int argc, char *argv[]) {
 
     auto scaler = std::make_unique<V4l2Scaler>();
     scaler->Configure(args.width, args.height, 320, 240, false, false);
+    scaler->OnCapture([&](V4l2Buffer &scaled_buffer, uint64_t tag) {
+        // the tag is the camera timestamp, which the result is given back with.
+        if (tag != TimestampUs(scaled_buffer.timestamp)) {
+            mismatched++;
+        }
+
+        if (is_finished) {
+            return;
+        }
+
+        if (images_nb++ < args.fps * record_sec) {
+            WriteImage(scaled_buffer, images_nb);
+        } else {
+            is_finished = true;
+            cond_var.notify_all();
+        }
+    });
     scaler->Start();
 
     auto capturer = V4l2Capturer::Create(args);
     auto observer = capturer->AsRawBufferObservable();
     observer->Subscribe([&](V4l2Buffer buffer) {
-        scaler->EmplaceBuffer(buffer, [&](V4l2Buffer scaled_buffer) {
-            if (is_finished) {
-                return;
-            }
-
-            if (images_nb++ < args.fps * record_sec) {
-                WriteImage(scaled_buffer, images_nb);
-            } else {
-                is_finished = true;
-                cond_var.notify_all();
-            }
-        });
+        scaler->EmplaceBuffer(buffer, TimestampUs(buffer.timestamp));
     });
 
     std::unique_lock<std::mutex> lock(mtx);
@@ -64,6 +75,7 @@ int main(int argc, char *argv[]) {
     scaler->Stop();
     scaler->ReleaseCodec();
     observer->UnSubscribe();
+    printf("Mismatched tags: %d\n", mismatched);
 
-    return 0;
+    return mismatched == 0 ? 0 : 1;
 }
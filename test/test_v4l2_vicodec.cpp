@@ -0,0 +1,84 @@
+#include "v4l2_codecs/v4l2_codec.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Run against the virtual M2M codec: `sudo modprobe vicodec multiplanar=1`,
+ * then pass the stateful encoder node, e.g. `./test_v4l2_vicodec /dev/video2`. */
+class VicodecEncoder : public V4l2Codec {
+  public:
+    bool Configure(const char *file, int width, int height) {
+        if (!Open(file)) {
+            return false;
+        }
+        if (!PrepareBuffer(&output_, width, height, V4L2_PIX_FMT_YUV420,
+                           V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, 4) ||
+            !PrepareBuffer(&capture_, width, height, V4L2_PIX_FMT_FWHT,
+                           V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, 4)) {
+            return false;
+        }
+        V4l2Util::StreamOn(fd_, output_.type);
+        V4l2Util::StreamOn(fd_, capture_.type);
+        return true;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    std::string device = argc > 1 ? argv[1] : "/dev/video2";
+    int width = 640;
+    int height = 480;
+    int total_frames = 300;
+
+    std::mutex mtx;
+    std::condition_variable cond_var;
+    int completed = 0;
+    int out_of_order = 0;
+    long last_sec = -1;
+
+    auto encoder = std::make_unique<VicodecEncoder>();
+    if (!encoder->Configure(device.c_str(), width, height)) {
+        printf("Failed to configure vicodec on %s\n", device.c_str());
+        return 1;
+    }
+    encoder->OnCapture([&](V4l2Buffer &encoded_buffer, uint64_t tag) {
+        std::lock_guard<std::mutex> lock(mtx);
+        // both the tag and the timestamp carry the frame number of the matching submission.
+        long sec = encoded_buffer.timestamp.tv_sec;
+        if ((long)tag != sec || sec <= last_sec) {
+            out_of_order++;
+        }
+        last_sec = sec;
+        completed++;
+        cond_var.notify_all();
+    });
+    encoder->Start();
+
+    std::vector<uint8_t> frame(width * height * 3 / 2, 0x80);
+    int submitted = 0;
+    auto start_time = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < total_frames; i++) {
+        V4l2Buffer buffer(frame.data(), frame.size(), 0, {i, 0});
+        submitted += encoder->EmplaceBuffer(buffer, i) ? 1 : 0;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond_var.wait_for(lock, std::chrono::seconds(5), [&] {
+            return completed >= submitted;
+        });
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start_time)
+                        .count();
+    printf("submitted: %d, completed: %d, mismatched: %d, fps: %.2f\n", submitted, completed,
+           out_of_order, completed / (duration / 1000.0));
+
+    encoder->ReleaseCodec();
+
+    return (submitted == total_frames && completed == submitted && out_of_order == 0) ? 0 : 1;
+}